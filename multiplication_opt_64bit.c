@@ -6,387 +6,2933 @@
 #include <string.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <math.h>
+#include <ctype.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "product_index.h"
 
 // Hash table implementation for efficient unique element tracking
 #define HASH_SIZE 16777259 // Large prime number for hash table size
 #define LOAD_FACTOR_THRESHOLD 0.7
+#define HASH_SEGMENTS 64 // Independently growing segments per hash set
 
+// Values per window for the bitmap sieve engine (2^21 bits = 256 KiB)
+#define BITMAP_WINDOW_BITS ((int64_t)1 << 21)
+
+// Radix sort digit width and the smallest input worth sorting with threads
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_PARALLEL_MIN ((int64_t)1 << 20)
+
+// Largest block of pairs handed out at once by the dynamic scheduler
+#define SCHED_BLOCK_PAIRS ((int64_t)1 << 20)
+
+// Pairs per thread task in the hybrid engine, and tasks per thread per round
+#define HYBRID_TASK_PAIRS ((int64_t)1 << 16)
+#define HYBRID_TASKS_PER_THREAD 4
+
+// Table size the distinct-product estimator scales down to, and its headroom
+#define ESTIMATE_SAMPLE_N 1024
+#define ESTIMATE_MARGIN 1.1
+
+// Default memory budget for a spilling hash set, and run file I/O buffer size
+#define DEFAULT_MEMORY_MB 1024
+#define RUN_IO_BUFFER (1 << 16)
+
+// Largest message of an encoded unique set, and the tags of its messages
+#define WIRE_CHUNK_BYTES ((int64_t)1 << 26)
+#define WIRE_TAG_HEADER 1
+#define WIRE_TAG_DATA 2
+
+// Pairs generated between flushes in the streaming dedup, and its message tags
+#define STREAM_BLOCK_PAIRS ((int64_t)1 << 20)
+#define STREAM_TAG_DATA 3
+#define STREAM_TAG_DONE 4
+// Blocks of chunks a process may have in flight before it stops generating
+// and waits for its sends, which bounds the memory of unsent chunks
+#define STREAM_MAX_PENDING_BLOCKS 4
+
+// Default seconds between checkpoints
+#define DEFAULT_CHECKPOINT_INTERVAL 600.0
+
+// Most distinct primes a product of two factors <= N can have (N < 2^32)
+#define DIVISOR_MAX_PRIMES 16
+
+// HyperLogLog registers (2^bits) for --approx: default 0.41% standard error
+#define DEFAULT_APPROX_BITS 16
+#define MIN_APPROX_BITS 4
+#define MAX_APPROX_BITS 24
+
+// Largest product the 32-bit keys of the hash engine hold; every product of
+// a square table with N <= 65535 fits. UINT32_MAX itself is kept free as the
+// alltoall splitter sentinel.
+#define KEY32_MAX_PRODUCT ((int64_t)UINT32_MAX - 1)
+
+// Largest N whose three-factor products N^3 fit in 64 bits
+#define FACTORS3_MAX_N 2097151
+
+// Probe-length histogram bins for -DHASH_STATS builds (the last bin is "or more")
+#define HASH_STATS_BINS 32
+
+// Swiss set: control bytes probed per group, empty marker, insert batch size
+#define SWISS_GROUP 16
+#define SWISS_EMPTY 0x80
+#define SWISS_BATCH 64
+
+#ifdef HASH_STATS
+// HashSet instrumentation, compiled in with -DHASH_STATS. Every HashSet of a
+// process adds to the same counters; probe length is the number of occupied
+// buckets stepped over before the value or an empty bucket is found.
 typedef struct {
-    int64_t* buckets;
-    int64_t size;
-    int64_t count;
-} HashSet;
+    int64_t lookups;
+    int64_t probes;
+    int64_t max_probe;
+    int64_t histogram[HASH_STATS_BINS];
+    int64_t resizes;
+    double resize_seconds;
+    int64_t bytes;           // Bucket memory currently allocated
+    int64_t peak_bytes;
+    int64_t final_count;     // Size and count of the last set freed
+    int64_t final_size;
+} HashStats;
 
-// Initialize a hash set
-void hashset_init(HashSet* set, int64_t size) {
-    set->size = size;
-    set->count = 0;
-    set->buckets = (int64_t*)calloc(size, sizeof(int64_t));
-    // Initialize all buckets to -1 (empty)
-    for (int64_t i = 0; i < size; i++) {
-        set->buckets[i] = -1;
-    }
+static HashStats hash_stats;
+
+// Record one lookup that stepped over probe occupied buckets
+static inline void hash_stats_probe(int64_t probe) {
+    hash_stats.lookups++;
+    hash_stats.probes += probe;
+    if (probe > hash_stats.max_probe) hash_stats.max_probe = probe;
+    hash_stats.histogram[probe < HASH_STATS_BINS - 1 ? probe : HASH_STATS_BINS - 1]++;
+}
+
+// Start the counters of a new query. Bucket memory still allocated (the set
+// kept between --batch queries) stays counted.
+static inline void hash_stats_reset(void) {
+    int64_t bytes = hash_stats.bytes;
+    memset(&hash_stats, 0, sizeof(hash_stats));
+    hash_stats.bytes = bytes;
+    hash_stats.peak_bytes = bytes;
+}
+
+// Record bucket memory being allocated (positive) or freed (negative)
+static inline void hash_stats_bytes(int64_t bytes) {
+    hash_stats.bytes += bytes;
+    if (hash_stats.bytes > hash_stats.peak_bytes) hash_stats.peak_bytes = hash_stats.bytes;
 }
+#endif
 
-// Hash function
-uint64_t hash(int64_t value, int64_t size) {
+// Slack up to which a hash set kept between --batch queries is reused: a
+// segment more than this many times the size the next query needs costs more
+// to clear than a fresh allocation
+#define HASH_REUSE_SLACK 4
+
+// Hash function: mixes the bits of a value; callers reduce it to a table size
+uint64_t hash_mix(int64_t value) {
     uint64_t h = (uint64_t)value;
     h = ((h >> 32) ^ h) * 0x45d9f3b;
     h = ((h >> 32) ^ h) * 0x45d9f3b;
     h = (h >> 32) ^ h;
-    return h % size;
+    return h;
+}
+
+// Lock-free hash set shared by all threads of a process. The capacity is a
+// power of two, empty buckets hold 0 (products are positive, so calloc gives
+// an empty table) and a thread claims an empty bucket with a single CAS. The
+// table never grows while threads are inserting; callers reserve room for a
+// whole round of inserts up front with concurrent_hashset_reserve.
+typedef struct {
+    int64_t* buckets;
+    int64_t capacity;
+    int64_t count;
+} ConcurrentHashSet;
+
+// Initialize a concurrent hash set with room for at least min_capacity buckets
+void concurrent_hashset_init(ConcurrentHashSet* set, int64_t min_capacity) {
+    set->capacity = 1024;
+    while (set->capacity < min_capacity) {
+        set->capacity *= 2;
+    }
+    set->count = 0;
+    set->buckets = (int64_t*)calloc(set->capacity, sizeof(int64_t));
 }
 
-// Add a value to the hash set, returns true if added (was not present)
-bool hashset_add(HashSet* set, int64_t value) {
-    // Skip if value is 0 (our marker for deleted/empty)
+// Insert a value from any thread, returns true if this call added it
+bool concurrent_hashset_add(ConcurrentHashSet* set, int64_t value) {
     if (value <= 0) return false;
 
-    // Check load factor and resize if needed
-    if ((double)set->count / set->size > LOAD_FACTOR_THRESHOLD) {
-        // Create a new larger hash set
-        HashSet new_set;
-        int64_t new_size = set->size * 2;
-        hashset_init(&new_set, new_size);
-        
-        // Rehash all existing elements
-        for (int64_t i = 0; i < set->size; i++) {
-            if (set->buckets[i] > 0) {
-                hashset_add(&new_set, set->buckets[i]);
+    uint64_t mask = (uint64_t)set->capacity - 1;
+    uint64_t pos = hash_mix(value) & mask;
+    while (true) {
+        int64_t current = __atomic_load_n(&set->buckets[pos], __ATOMIC_RELAXED);
+        if (current == value) {
+            return false;
+        }
+        if (current == 0) {
+            int64_t expected = 0;
+            if (__atomic_compare_exchange_n(&set->buckets[pos], &expected, value, false,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                return true;
+            }
+            // Another thread filled the bucket first, maybe with this value
+            if (expected == value) {
+                return false;
             }
         }
-        
-        // Free old buckets and update set
-        free(set->buckets);
-        set->buckets = new_set.buckets;
-        set->size = new_size;
-        set->count = new_set.count;
-    }
-    
-    // Find position using linear probing
-    uint64_t pos = hash(value, set->size);
-    while (set->buckets[pos] != -1) {
-        // If already exists, return false
-        if (set->buckets[pos] == value) {
-            return false;
+        pos = (pos + 1) & mask;
+    }
+}
+
+// Grow the table (outside any parallel insert) until extra more values fit
+// under LOAD_FACTOR_THRESHOLD. Rehashing itself runs on all threads.
+void concurrent_hashset_reserve(ConcurrentHashSet* set, int64_t extra) {
+    int64_t new_capacity = set->capacity;
+    while ((double)(set->count + extra) > new_capacity * LOAD_FACTOR_THRESHOLD) {
+        new_capacity *= 2;
+    }
+    if (new_capacity == set->capacity) return;
+
+    ConcurrentHashSet grown;
+    concurrent_hashset_init(&grown, new_capacity);
+
+    #pragma omp parallel for schedule(static)
+    for (int64_t b = 0; b < set->capacity; b++) {
+        if (set->buckets[b] > 0) {
+            concurrent_hashset_add(&grown, set->buckets[b]);
         }
-        // Linear probing
-        pos = (pos + 1) % set->size;
     }
-    
-    // Insert value
-    set->buckets[pos] = value;
-    set->count++;
-    return true;
+
+    free(set->buckets);
+    set->buckets = grown.buckets;
+    set->capacity = grown.capacity;
 }
 
-// Free the hash set
-void hashset_free(HashSet* set) {
+// Free the concurrent hash set
+void concurrent_hashset_free(ConcurrentHashSet* set) {
     free(set->buckets);
     set->buckets = NULL;
-    set->size = 0;
+    set->capacity = 0;
     set->count = 0;
 }
 
-// Convert hash set to array for MPI transfer
-int64_t* hashset_to_array(HashSet* set, int64_t* size) {
-    int64_t* array = (int64_t*)malloc(set->count * sizeof(int64_t));
+// Convert the concurrent hash set to an array for MPI transfer
+int64_t* concurrent_hashset_to_array(ConcurrentHashSet* set, int64_t* size) {
+    int64_t* array = (int64_t*)malloc((set->count > 0 ? set->count : 1) * sizeof(int64_t));
     int64_t idx = 0;
-    
-    for (int64_t i = 0; i < set->size; i++) {
-        if (set->buckets[i] > 0) {
-            array[idx++] = set->buckets[i];
+
+    for (int64_t b = 0; b < set->capacity; b++) {
+        if (set->buckets[b] > 0) {
+            array[idx++] = set->buckets[b];
         }
     }
-    
+
     *size = idx;
     return array;
 }
 
-// Merge two sorted arrays into a new sorted array, counting unique elements
-int64_t merge_unique_count(int64_t* arr1, int64_t size1, int64_t* arr2, int64_t size2) {
-    if (size1 == 0) return size2;
-    if (size2 == 0) return size1;
-    
-    int64_t i = 0, j = 0;
-    int64_t unique_count = 0;
-    int64_t last = -1;
-    
-    while (i < size1 && j < size2) {
-        if (arr1[i] < arr2[j]) {
-            if (arr1[i] != last) {
-                unique_count++;
-                last = arr1[i];
-            }
-            i++;
-        } else if (arr1[i] > arr2[j]) {
-            if (arr2[j] != last) {
-                unique_count++;
-                last = arr2[j];
-            }
-            j++;
-        } else { // Equal elements
-            if (arr1[i] != last) {
-                unique_count++;
-                last = arr1[i];
-            }
-            i++;
-            j++;
-        }
+// Swiss-table style hash set. Every slot has a one-byte control word: either
+// SWISS_EMPTY or the low 7 bits of the value's hash (its tag). Slots are
+// probed a group of SWISS_GROUP control bytes at a time, compared against the
+// tag with one SSE2 instruction, so most lookups touch one cache line of
+// control bytes and at most one slot. The capacity is a power of two, probing
+// is masked rather than reduced with a modulo, and the load limit is tracked
+// as an integer count of inserts left before the next resize.
+typedef struct {
+    uint8_t* ctrl;
+    int64_t* slots;
+    int64_t capacity;
+    int64_t count;
+    int64_t growth_left;
+} SwissSet;
+
+// Full 64-bit finalizer (MurmurHash3 fmix64); the tag and the group index
+// come from different bits, so the mixing has to reach all of them
+uint64_t swiss_hash(int64_t value) {
+    uint64_t h = (uint64_t)value;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Initialize a swiss set with room for at least min_capacity slots
+void swiss_init(SwissSet* set, int64_t min_capacity) {
+    set->capacity = SWISS_GROUP * 64;
+    while (set->capacity < min_capacity) {
+        set->capacity *= 2;
     }
-    
-    // Handle remaining elements
-    while (i < size1) {
-        if (arr1[i] != last) {
-            unique_count++;
-            last = arr1[i];
+    set->count = 0;
+    set->growth_left = set->capacity / 8 * 7;
+    set->ctrl = (uint8_t*)malloc(set->capacity);
+    memset(set->ctrl, SWISS_EMPTY, set->capacity);
+    set->slots = (int64_t*)malloc(set->capacity * sizeof(int64_t));
+}
+
+// Bit k set when control byte k of the group equals byte
+static inline uint32_t swiss_group_match(const uint8_t* group, uint8_t byte) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)byte)));
+#else
+    uint32_t mask = 0;
+    for (int k = 0; k < SWISS_GROUP; k++) {
+        if (group[k] == byte) mask |= 1u << k;
+    }
+    return mask;
+#endif
+}
+
+// Insert a value known to be absent with free room (used when rehashing)
+static void swiss_insert_new(SwissSet* set, int64_t value, uint64_t h) {
+    uint64_t group_mask = (uint64_t)(set->capacity / SWISS_GROUP) - 1;
+    uint64_t group = (h >> 7) & group_mask;
+    for (uint64_t step = 1; ; step++) {
+        uint8_t* ctrl = set->ctrl + group * SWISS_GROUP;
+        uint32_t empty = swiss_group_match(ctrl, SWISS_EMPTY);
+        if (empty) {
+            int k = __builtin_ctz(empty);
+            ctrl[k] = (uint8_t)(h & 0x7f);
+            set->slots[group * SWISS_GROUP + k] = value;
+            return;
         }
-        i++;
+        // Triangular probing visits every group of a power-of-two table
+        group = (group + step) & group_mask;
     }
-    
-    while (j < size2) {
-        if (arr2[j] != last) {
-            unique_count++;
-            last = arr2[j];
+}
+
+// Double the capacity until at least extra more values fit
+void swiss_reserve(SwissSet* set, int64_t extra) {
+    if (extra <= set->growth_left) return;
+
+    int64_t new_capacity = set->capacity;
+    while ((new_capacity / 8 * 7) - set->count < extra) {
+        new_capacity *= 2;
+    }
+
+    SwissSet grown;
+    swiss_init(&grown, new_capacity);
+    for (int64_t s = 0; s < set->capacity; s++) {
+        if (set->ctrl[s] != SWISS_EMPTY) {
+            swiss_insert_new(&grown, set->slots[s], swiss_hash(set->slots[s]));
         }
-        j++;
     }
-    
-    return unique_count;
+    grown.count = set->count;
+    grown.growth_left -= set->count;
+
+    free(set->ctrl);
+    free(set->slots);
+    *set = grown;
 }
 
-// In-place merge sort implementation for int64_t
-void merge(int64_t arr[], int64_t left, int64_t mid, int64_t right) {
-    int64_t i, j, k;
-    int64_t n1 = mid - left + 1;
-    int64_t n2 = right - mid;
-    
-    // Create temp arrays
-    int64_t* L = (int64_t*)malloc(n1 * sizeof(int64_t));
-    int64_t* R = (int64_t*)malloc(n2 * sizeof(int64_t));
-    
-    // Copy data to temp arrays
-    for (i = 0; i < n1; i++)
-        L[i] = arr[left + i];
-    for (j = 0; j < n2; j++)
-        R[j] = arr[mid + 1 + j];
-    
-    // Merge the temp arrays back
-    i = 0;
-    j = 0;
-    k = left;
-    while (i < n1 && j < n2) {
-        if (L[i] <= R[j]) {
-            arr[k] = L[i];
-            i++;
-        } else {
-            arr[k] = R[j];
-            j++;
+// Add a value whose hash is already known, with room already reserved.
+// Returns true if added (was not present).
+static inline bool swiss_add_hashed(SwissSet* set, int64_t value, uint64_t h) {
+    uint64_t group_mask = (uint64_t)(set->capacity / SWISS_GROUP) - 1;
+    uint64_t group = (h >> 7) & group_mask;
+    uint8_t tag = (uint8_t)(h & 0x7f);
+
+    for (uint64_t step = 1; ; step++) {
+        uint8_t* ctrl = set->ctrl + group * SWISS_GROUP;
+        int64_t* slots = set->slots + group * SWISS_GROUP;
+
+        for (uint32_t match = swiss_group_match(ctrl, tag); match; match &= match - 1) {
+            if (slots[__builtin_ctz(match)] == value) {
+                return false;
+            }
+        }
+
+        // Nothing is ever deleted, so an empty slot ends the probe sequence
+        uint32_t empty = swiss_group_match(ctrl, SWISS_EMPTY);
+        if (empty) {
+            int k = __builtin_ctz(empty);
+            ctrl[k] = tag;
+            slots[k] = value;
+            set->count++;
+            set->growth_left--;
+            return true;
         }
-        k++;
+        group = (group + step) & group_mask;
     }
-    
-    // Copy remaining elements
-    while (i < n1) {
-        arr[k] = L[i];
-        i++;
-        k++;
+}
+
+// Add a value to the swiss set, returns true if added (was not present)
+bool swiss_add(SwissSet* set, int64_t value) {
+    if (set->growth_left == 0) swiss_reserve(set, 1);
+    return swiss_add_hashed(set, value, swiss_hash(value));
+}
+
+// Add a batch of values. All hashes are computed and every target group is
+// prefetched before the first insert, so the cache misses of the batch
+// overlap instead of being paid one after another.
+void swiss_insert_many(SwissSet* set, const int64_t* values, int n) {
+    uint64_t hashes[SWISS_BATCH];
+    swiss_reserve(set, n);
+
+    uint64_t group_mask = (uint64_t)(set->capacity / SWISS_GROUP) - 1;
+    for (int k = 0; k < n; k++) {
+        hashes[k] = swiss_hash(values[k]);
+        uint64_t base = ((hashes[k] >> 7) & group_mask) * SWISS_GROUP;
+        __builtin_prefetch(set->ctrl + base);
+        __builtin_prefetch(set->slots + base);
     }
-    while (j < n2) {
-        arr[k] = R[j];
-        j++;
-        k++;
+    for (int k = 0; k < n; k++) {
+        swiss_add_hashed(set, values[k], hashes[k]);
     }
-    
-    free(L);
-    free(R);
 }
 
-// Merge sort function
-void merge_sort(int64_t arr[], int64_t left, int64_t right) {
-    if (left < right) {
-        int64_t mid = left + (right - left) / 2;
-        
-        // Sort first and second halves
-        merge_sort(arr, left, mid);
-        merge_sort(arr, mid + 1, right);
-        
-        // Merge the sorted halves
-        merge(arr, left, mid, right);
+// Free the swiss set
+void swiss_free(SwissSet* set) {
+    free(set->ctrl);
+    free(set->slots);
+    set->ctrl = NULL;
+    set->slots = NULL;
+    set->capacity = 0;
+    set->count = 0;
+    set->growth_left = 0;
+}
+
+// Convert the swiss set to an array for MPI transfer
+int64_t* swiss_to_array(SwissSet* set, int64_t* size) {
+    int64_t* array = (int64_t*)malloc((set->count > 0 ? set->count : 1) * sizeof(int64_t));
+    int64_t idx = 0;
+
+    for (int64_t s = 0; s < set->capacity; s++) {
+        if (set->ctrl[s] != SWISS_EMPTY) {
+            array[idx++] = set->slots[s];
+        }
     }
+
+    *size = idx;
+    return array;
 }
 
-int main(int argc, char *argv[]) {
-    MPI_Init(&argc, &argv);
-    int world_size, world_rank;
-    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
-    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
-    double start_time, end_time;
-    
-    if (world_rank == 0) {
-        start_time = MPI_Wtime();
+// Upper-triangle pair numbering: the pairs (i, j) with 1 <= i <= j <= N are
+// numbered from 0 row by row, so row i holds N - i + 1 consecutive indexes.
+
+// Integer square root, floor(sqrt(x)), without going through floating point
+int64_t isqrt64(int64_t x) {
+    if (x < 2) return x;
+    int64_t r = x;
+    int64_t next = (r + x / r) / 2;
+    while (next < r) {
+        r = next;
+        next = (r + x / r) / 2;
     }
+    return r;
+}
 
-    // Get N from command line argument, default to 10 for safety
-    int64_t N = 10;
-    if (argc > 1) {
-        N = atoll(argv[1]);
-        
-        // Verify N is within reasonable bounds
-        if (N <= 0) {
-            if (world_rank == 0) {
-                printf("Error: N must be positive\n");
-                fflush(stdout);
-            }
-            MPI_Finalize();
-            return 1;
+// Index of the first pair (i, i) of row i
+int64_t triangle_row_start(int64_t N, int64_t i) {
+    return (i - 1) * (2 * N - i + 2) / 2;
+}
+
+// Index of pair (i, j), the inverse of triangle_pair
+int64_t triangle_index(int64_t N, int64_t i, int64_t j) {
+    return triangle_row_start(N, i) + (j - i);
+}
+
+// Pair (i, j) at the given index in O(1). Row i - 1 = r is the largest r
+// with r * (2N + 1 - r) / 2 <= index, the smaller root of that quadratic.
+void triangle_pair(int64_t N, int64_t index, int64_t* i, int64_t* j) {
+    int64_t b = 2 * N + 1;
+    int64_t r = (b - isqrt64(b * b - 8 * index)) / 2;
+    if (r < 0) r = 0;
+    if (r > N - 1) r = N - 1;
+
+    // The integer root can be off by one either way
+    while (r > 0 && triangle_row_start(N, r + 1) > index) r--;
+    while (r < N - 1 && triangle_row_start(N, r + 2) <= index) r++;
+
+    *i = r + 1;
+    *j = *i + (index - triangle_row_start(N, *i));
+}
+
+// A process's share of the upper triangle: every pair from (first_i, first_j)
+// to (last_i, last_j) inclusive in row-major order. Rows strictly between the
+// two ends are complete (j runs from i to N).
+typedef struct {
+    int64_t first_i, first_j;
+    int64_t last_i, last_j;
+    int64_t pairs;
+} PairSpan;
+
+// Span covering the pair indexes start_idx..end_idx inclusive. A span with
+// no pairs has last_i < first_i.
+PairSpan pair_span(int64_t N, int64_t start_idx, int64_t end_idx) {
+    PairSpan span;
+    span.pairs = end_idx - start_idx + 1;
+    if (span.pairs <= 0) {
+        span.first_i = 1;
+        span.first_j = 1;
+        span.last_i = 0;
+        span.last_j = 0;
+        span.pairs = 0;
+        return span;
+    }
+
+    triangle_pair(N, start_idx, &span.first_i, &span.first_j);
+    triangle_pair(N, end_idx, &span.last_i, &span.last_j);
+    return span;
+}
+
+// Row 1 holds every value 1..N, so any pair with i*j <= N is a duplicate of
+// it. Engines that collect products start row i at the first j with
+// i*j > N (row 1 is skipped entirely), then add the N covered values back
+// on process 0.
+static inline int64_t covered_row_start(int64_t N, int64_t i, int64_t j_first) {
+    int64_t j_min = N / i + 1;
+    return j_first > j_min ? j_first : j_min;
+}
+
+// Three-factor tables number the triples (i, j, k) with 1 <= i <= j <= k <= N
+// the same way, by i, then j, then k. The triples with first factor i are the
+// pairs (j, k) of the triangle over i..N, so they are numbered with the pair
+// numbering of an (N - i + 1)-triangle.
+
+// Number of triples with all three factors in an n-value range, n(n+1)(n+2)/6
+static inline int64_t triple_count(int64_t n) {
+    return n * (n + 1) / 2 * (n + 2) / 3;
+}
+
+// Index of the first triple (i, i, i) with first factor i
+int64_t triple_block_start(int64_t N, int64_t i) {
+    return triple_count(N) - triple_count(N - i + 1);
+}
+
+// Triple (i, j, k) at the given index: a binary search for i, then the pair
+// of the (N - i + 1)-triangle
+void triple_at(int64_t N, int64_t index, int64_t* i, int64_t* j, int64_t* k) {
+    int64_t lo = 1, hi = N;
+    while (lo < hi) {
+        int64_t mid = lo + (hi - lo + 1) / 2;
+        if (triple_block_start(N, mid) <= index) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
         }
-    } else if (world_rank == 0) {
-        printf("No value provided for N, using default N=10\n");
-        fflush(stdout);
     }
-    
-    // Broadcast N to all processes
-    MPI_Bcast(&N, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
 
-    // Calculate total number of products in upper triangular matrix
-    int64_t total_pairs = ((int64_t)N * ((int64_t)N + 1)) / 2;
+    int64_t pj, pk;
+    triangle_pair(N - lo + 1, index - triple_block_start(N, lo), &pj, &pk);
+    *i = lo;
+    *j = pj + lo - 1;
+    *k = pk + lo - 1;
+}
+
+// Split total_pairs work items (pairs, or triples with --factors=3) into
+// world_size contiguous index ranges whose sizes differ by at most one item.
+// An empty range has end_idx < start_idx.
+void partition_range(int64_t total_pairs, int world_rank, int world_size,
+                     int64_t* start_idx, int64_t* end_idx) {
     int64_t pairs_per_proc = total_pairs / world_size;
     int64_t remainder = total_pairs % world_size;
-    
-    // Determine start and end indexes
-    int64_t start_idx = world_rank * pairs_per_proc + (world_rank < remainder ? world_rank : remainder);
-    int64_t end_idx = start_idx + pairs_per_proc + (world_rank < remainder ? 1 : 0) - 1;
-    
+
+    *start_idx = world_rank * pairs_per_proc + (world_rank < remainder ? world_rank : remainder);
+    *end_idx = *start_idx + pairs_per_proc + (world_rank < remainder ? 1 : 0) - 1;
+}
+
+// This process's share of partition_range as a span
+PairSpan partition_pairs(int64_t N, int world_rank, int world_size) {
+    int64_t start_idx, end_idx;
+    partition_range((N * (N + 1)) / 2, world_rank, world_size, &start_idx, &end_idx);
+    return pair_span(N, start_idx, end_idx);
+}
+
+// Shared work counter for dynamic scheduling. Process 0 exposes a single
+// int64_t through an MPI window and every process claims the next block of
+// work with an atomic MPI_Fetch_and_op, so idle processes keep taking blocks
+// until the counter passes the end of the work.
+typedef struct {
+    MPI_Win win;
+    int64_t* value;
+} WorkCounter;
+
+// Collective: create the counter, starting at 0
+void work_counter_init(WorkCounter* counter, int world_rank) {
+    MPI_Aint size = (world_rank == 0) ? sizeof(int64_t) : 0;
+    MPI_Win_allocate(size, sizeof(int64_t), MPI_INFO_NULL, MPI_COMM_WORLD,
+                     &counter->value, &counter->win);
     if (world_rank == 0) {
-        printf("Computing M(%" PRId64 ") with %d processes...\n", N, world_size);
-        fflush(stdout);
+        *counter->value = 0;
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Win_lock_all(0, counter->win);
+}
+
+// Atomically advance the counter by block and return its previous value
+int64_t work_counter_next(WorkCounter* counter, int64_t block) {
+    int64_t start;
+    MPI_Fetch_and_op(&block, &start, MPI_LONG_LONG, 0, 0, MPI_SUM, counter->win);
+    MPI_Win_flush(0, counter->win);
+    return start;
+}
+
+// Collective: release the counter window
+void work_counter_free(WorkCounter* counter) {
+    MPI_Win_unlock_all(counter->win);
+    MPI_Win_free(&counter->win);
+}
+
+// Pairs per dynamically scheduled block: SCHED_BLOCK_PAIRS, shrunk for small
+// tables so every process still sees several blocks
+int64_t sched_block_pairs(int64_t total_pairs, int world_size) {
+    int64_t block = total_pairs / ((int64_t)world_size * 8);
+    if (block > SCHED_BLOCK_PAIRS) block = SCHED_BLOCK_PAIRS;
+    if (block < 1) block = 1;
+    return block;
+}
+
+// Phases timed on every process for --timings. Each phase_lap() charges the
+// time since the previous lap to one phase, so the phases add up to the run.
+typedef enum {
+    PHASE_GENERATE,      // Generate products and insert them into the local structure
+    PHASE_WAIT,          // Wait for the slowest process to finish generating
+    PHASE_TO_ARRAY,      // Copy the local set out to an array
+    PHASE_LOCAL_SORT,    // Sort the local array
+    PHASE_EXCHANGE,      // Move local results between processes
+    PHASE_GLOBAL_COUNT,  // Sort and count the combined results
+    PHASE_COUNT
+} Phase;
+
+static const char* const phase_names[PHASE_COUNT] = {
+    "generate", "wait", "to_array", "local_sort", "exchange", "global_count"
+};
+
+static double phase_seconds[PHASE_COUNT];
+static double phase_mark;
+
+// Charge the time since the previous lap to phase
+void phase_lap(Phase phase) {
+    double now = MPI_Wtime();
+    phase_seconds[phase] += now - phase_mark;
+    phase_mark = now;
+}
+
+// Strategies for combining the per-process unique sets into M(N)
+typedef enum {
+    DEDUP_GATHER,    // Gather every local set on process 0 and dedup there
+    DEDUP_ALLTOALL,  // Route products to value-range owners and dedup in parallel
+    DEDUP_TREE,      // Merge sorted runs pairwise up a binomial tree to process 0
+    DEDUP_STREAM     // Send each block's products to their owners while generating
+} DedupMode;
+
+// Dedup names accepted by --dedup, in DedupMode order
+static const char* const dedup_names[] = {"gather", "alltoall", "tree", "stream"};
+
+// Counting engines for the distinct products
+typedef enum {
+    ENGINE_HASH,     // Per-process hash sets merged by the dedup strategy
+    ENGINE_BITMAP,   // Segmented bitmap sieve over fixed value windows
+    ENGINE_HYBRID,   // One shared lock-free hash set per process, filled by threads
+    ENGINE_SWISS,    // Per-process swiss-table sets with SIMD group probing
+    ENGINE_DIVISOR,  // Divisor tests decide which products are new, no set at all
+    ENGINE_MERGE,    // Heap merge of the sorted rows, no hashing or local sort
+    ENGINE_SHARED    // One bitmap per node in shared memory, set with atomic OR
+} Engine;
+
+// Engine names accepted by --engine, in Engine order
+static const char* const engine_names[] = {"hash", "bitmap", "hybrid", "swiss", "divisor", "merge", "shared"};
+
+// How work is assigned to processes
+typedef enum {
+    SCHED_STATIC,    // One equal contiguous share per process, fixed up front
+    SCHED_DYNAMIC    // Blocks claimed on demand from a shared atomic counter
+} Schedule;
+
+// Run-time options parsed from the command line
+typedef struct {
+    int64_t N;
+    Engine engine;
+    DedupMode dedup;
+    Schedule schedule;
+    const char* spill_dir;   // Spill sorted runs here when set (hash engine only)
+    int64_t memory_mb;       // Per-process hash set budget before spilling, per-node shared bitmap size
+    const char* checkpoint_dir;  // Write periodic checkpoints here when set
+    double checkpoint_interval;  // Seconds between checkpoints
+    bool resume;                 // Continue from existing checkpoints
+    int64_t sweep_step;          // Sweep M(1..N) and save every step-th value, 0 = off
+    int approx_bits;             // Estimate M(N) with 2^approx_bits sketch registers, 0 = exact
+    const char* timings_file;    // Append per-process phase times here when set
+    const char* index_file;      // Write the distinct products here as a query index when set
+    int64_t* batch;              // Values of N to answer in one job, largest first
+    int64_t batch_count;         // 0 = answer the single N
+    const char* batch_file;      // Read more values of N for the batch from here
+    int64_t rows;                // Rectangular rows x N table (rows < N), 0 = square
+    int factors;                 // 2 for i*j, 3 for i*j*k (i <= j <= k <= N)
+} Options;
+
+// Rows of the pair triangle the engines walk: i <= rows, i <= j <= N. A
+// rows x N table (rows <= N) holds the same products as these pairs, since
+// every pair with j < i <= rows is a pair of the rows too with i and j swapped.
+static inline int64_t table_rows(const Options* opts) {
+    return opts->rows > 0 ? opts->rows : opts->N;
+}
+
+// Number of work items of the table: the pairs of its rows, or the triples
+// i <= j <= k <= N of a three-factor table
+int64_t table_items(const Options* opts) {
+    if (opts->factors == 3) return triple_count(opts->N);
+    return triangle_row_start(opts->N, table_rows(opts) + 1);
+}
+
+// Number of entries of the full table, ordered pairs or triples
+int64_t table_cells(const Options* opts) {
+    if (opts->factors == 3) return opts->N * opts->N * opts->N;
+    return table_rows(opts) * opts->N;
+}
+
+// Whether every product fits the 32-bit keys
+static inline bool table_fits_key32(const Options* opts) {
+    int64_t N = opts->N;
+    if (opts->factors == 3) return N * N * N <= KEY32_MAX_PRODUCT;
+    return table_rows(opts) <= KEY32_MAX_PRODUCT / N;
+}
+
+// Printed name of the count: M(N), M(RxN) or M3(N)
+void table_label(const Options* opts, char* label, size_t size) {
+    if (opts->factors == 3) {
+        snprintf(label, size, "M3(%" PRId64 ")", opts->N);
+    } else if (opts->rows > 0) {
+        snprintf(label, size, "M(%" PRId64 "x%" PRId64 ")", opts->rows, opts->N);
+    } else {
+        snprintf(label, size, "M(%" PRId64 ")", opts->N);
     }
+}
 
-    // Initialize hash set for this process
-    // Choose initial size based on expected number of unique elements
-    int64_t initial_hashset_size = (end_idx - start_idx + 1) / 4;
-    if (initial_hashset_size < 1024) initial_hashset_size = 1024;
-    
-    HashSet unique_products;
-    hashset_init(&unique_products, initial_hashset_size);
-    
-    // Compute all products for assigned portion using a more efficient approach
-    int64_t i = 1;
-    int64_t j = i;
-    int64_t global_idx = 0;
-    
-    // Fast-forward to starting position
-    while (global_idx < start_idx) {
-        global_idx++;
-        j++;
-        if (j > N) {
-            i++;
-            j = i;
-        }
-    }
-    
-    // Compute products for our range and add directly to hash set
-    while (global_idx <= end_idx && i <= N) {
-        int64_t product = i * j;
-        hashset_add(&unique_products, product);
-        
-        global_idx++;
-        j++;
-        if (j > N) {
-            i++;
-            j = i;
+// Match the value of a "--name=value" option against its allowed choices.
+// Returns the index of the choice, or -1 (with an error on process 0).
+int parse_choice(const char* name, const char* value, const char* const choices[],
+                 int choice_count, int world_rank) {
+    for (int c = 0; c < choice_count; c++) {
+        if (strcmp(value, choices[c]) == 0) {
+            return c;
         }
     }
 
-    // Signal completion of local computation
-    int local_done = 1;
-    int all_done = 0;
-    MPI_Allreduce(&local_done, &all_done, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
-    
-    if (world_rank == 0 && all_done == world_size) {
-        printf("All processes have computed their unique products\n");
+    if (world_rank == 0) {
+        printf("Error: unknown %s '%s' (use", name, value);
+        for (int c = 0; c < choice_count; c++) {
+            printf("%s %s", c == 0 ? "" : (c == choice_count - 1 ? " or" : ","), choices[c]);
+        }
+        printf(")\n");
         fflush(stdout);
     }
+    return -1;
+}
 
-    // Convert local unique products to array for MPI transfer
-    int64_t local_unique_count = unique_products.count;
-    int64_t* local_unique_products = hashset_to_array(&unique_products, &local_unique_count);
-    
-    // Sort the local array for easier merging
-    merge_sort(local_unique_products, 0, local_unique_count - 1);
-    
-    // Need to use int for MPI calls since MPI doesn't handle int64_t directly
-    int local_count_int = (int)local_unique_count;
-    int* all_counts = NULL;
-    if (world_rank == 0) {
-        all_counts = (int*)malloc(world_size * sizeof(int));
+// Append the positive integers in text, separated by commas or whitespace, to
+// the batch. Returns false at the first token that is not one.
+bool append_batch_values(Options* opts, const char* text) {
+    const char* pos = text;
+    while (true) {
+        while (*pos == ',' || isspace((unsigned char)*pos)) pos++;
+        if (*pos == '\0') return true;
+
+        char* end;
+        long long value = strtoll(pos, &end, 10);
+        if (end == pos || value <= 0 || (*end != '\0' && *end != ',' && !isspace((unsigned char)*end))) {
+            return false;
+        }
+        opts->batch = (int64_t*)realloc(opts->batch, (opts->batch_count + 1) * sizeof(int64_t));
+        opts->batch[opts->batch_count++] = value;
+        pos = end;
     }
-    
-    MPI_Gather(&local_count_int, 1, MPI_INT, all_counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    
-    // Process 0 gathers all unique products and merges them
-    int64_t global_unique_count = 0;
-    
-    if (world_rank == 0) {
-        // Calculate displacements for MPI_Gatherv
-        int total_products_int = 0;
-        int* displacements = (int*)malloc(world_size * sizeof(int));
-        
-        for (int i = 0; i < world_size; i++) {
-            displacements[i] = total_products_int;
-            total_products_int += all_counts[i];
-        }
-        
-        // Allocate memory for all gathered products (as int64_t)
-        int64_t total_products = (int64_t)total_products_int;
-        int64_t* all_products = (int64_t*)malloc(total_products * sizeof(int64_t));
-        
-        // Gather all local unique products
-        // We need to cast to MPI_LONG_LONG for 64-bit integers
-        MPI_Gatherv(local_unique_products, local_count_int, MPI_LONG_LONG, 
-                   all_products, all_counts, displacements, 
-                   MPI_LONG_LONG, 0, MPI_COMM_WORLD);
-        
-        // Sort all gathered products
-        merge_sort(all_products, 0, total_products - 1);
-        
-        // Count unique elements in the merged array
-        if (total_products > 0) {
-            global_unique_count = 1;  // First element is always unique
-            for (int64_t i = 1; i < total_products; i++) {
-                if (all_products[i] != all_products[i-1]) {
-                    global_unique_count++;
+}
+
+// Parse "N [--engine=hash|bitmap|hybrid|swiss|divisor|merge|shared] [--dedup=gather|alltoall|tree|stream]
+// [--schedule=static|dynamic] [--spill-dir=DIR] [--memory-mb=MB]
+// [--checkpoint-dir=DIR [--checkpoint-interval=SECONDS] [--resume]]
+// [--sweep[=STEP]] [--approx[=BITS]] [--timings=FILE] [--index=FILE]
+// [--batch=N1,N2,... | --batch-file=FILE] [--rows=M | --factors=2|3]", returns
+// false on invalid input. A positional N given with a batch joins the batch.
+bool parse_options(int argc, char *argv[], Options* opts, int world_rank) {
+    static const char* const schedules[] = {"static", "dynamic"};
+
+    bool have_n = false;
+    bool engine_given = false;
+    bool dedup_given = false;
+    opts->N = 10;
+    opts->engine = ENGINE_HASH;
+    opts->dedup = DEDUP_GATHER;
+    opts->schedule = SCHED_STATIC;
+    opts->spill_dir = NULL;
+    opts->memory_mb = DEFAULT_MEMORY_MB;
+    opts->checkpoint_dir = NULL;
+    opts->checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+    opts->resume = false;
+    opts->sweep_step = 0;
+    opts->approx_bits = 0;
+    opts->timings_file = NULL;
+    opts->index_file = NULL;
+    opts->batch = NULL;
+    opts->batch_count = 0;
+    opts->batch_file = NULL;
+    opts->rows = 0;
+    opts->factors = 2;
+
+    for (int a = 1; a < argc; a++) {
+        int choice;
+        if (strncmp(argv[a], "--engine=", 9) == 0) {
+            if ((choice = parse_choice("engine", argv[a] + 9, engine_names, 7, world_rank)) < 0) return false;
+            opts->engine = (Engine)choice;
+            engine_given = true;
+        } else if (strncmp(argv[a], "--dedup=", 8) == 0) {
+            if ((choice = parse_choice("dedup mode", argv[a] + 8, dedup_names, 4, world_rank)) < 0) return false;
+            opts->dedup = (DedupMode)choice;
+            dedup_given = true;
+        } else if (strncmp(argv[a], "--schedule=", 11) == 0) {
+            if ((choice = parse_choice("schedule", argv[a] + 11, schedules, 2, world_rank)) < 0) return false;
+            opts->schedule = (Schedule)choice;
+        } else if (strncmp(argv[a], "--spill-dir=", 12) == 0) {
+            opts->spill_dir = argv[a] + 12;
+        } else if (strncmp(argv[a], "--memory-mb=", 12) == 0) {
+            opts->memory_mb = atoll(argv[a] + 12);
+            if (opts->memory_mb <= 0) {
+                if (world_rank == 0) {
+                    printf("Error: --memory-mb must be positive\n");
+                    fflush(stdout);
+                }
+                return false;
+            }
+        } else if (strncmp(argv[a], "--checkpoint-dir=", 17) == 0) {
+            opts->checkpoint_dir = argv[a] + 17;
+        } else if (strncmp(argv[a], "--checkpoint-interval=", 22) == 0) {
+            char* end;
+            opts->checkpoint_interval = strtod(argv[a] + 22, &end);
+            if (end == argv[a] + 22 || *end != '\0' || !(opts->checkpoint_interval > 0)) {
+                if (world_rank == 0) {
+                    printf("Error: --checkpoint-interval must be a positive number of seconds\n");
+                    fflush(stdout);
+                }
+                return false;
+            }
+        } else if (strcmp(argv[a], "--resume") == 0) {
+            opts->resume = true;
+        } else if (strcmp(argv[a], "--sweep") == 0) {
+            opts->sweep_step = 1;
+        } else if (strncmp(argv[a], "--sweep=", 8) == 0) {
+            opts->sweep_step = atoll(argv[a] + 8);
+            if (opts->sweep_step <= 0) {
+                if (world_rank == 0) {
+                    printf("Error: sweep step must be positive\n");
+                    fflush(stdout);
+                }
+                return false;
+            }
+        } else if (strncmp(argv[a], "--timings=", 10) == 0) {
+            opts->timings_file = argv[a] + 10;
+        } else if (strncmp(argv[a], "--batch=", 8) == 0) {
+            if (!append_batch_values(opts, argv[a] + 8)) {
+                if (world_rank == 0) {
+                    printf("Error: --batch takes positive integers separated by commas\n");
+                    fflush(stdout);
+                }
+                return false;
+            }
+        } else if (strncmp(argv[a], "--batch-file=", 13) == 0) {
+            opts->batch_file = argv[a] + 13;
+        } else if (strncmp(argv[a], "--rows=", 7) == 0) {
+            char* end;
+            opts->rows = strtoll(argv[a] + 7, &end, 10);
+            if (end == argv[a] + 7 || *end != '\0' || opts->rows <= 0) {
+                if (world_rank == 0) {
+                    printf("Error: --rows must be a positive integer\n");
+                    fflush(stdout);
+                }
+                return false;
+            }
+        } else if (strncmp(argv[a], "--factors=", 10) == 0) {
+            opts->factors = atoi(argv[a] + 10);
+            if (opts->factors != 2 && opts->factors != 3) {
+                if (world_rank == 0) {
+                    printf("Error: --factors must be 2 or 3\n");
+                    fflush(stdout);
+                }
+                return false;
+            }
+        } else if (strncmp(argv[a], "--index=", 8) == 0) {
+            opts->index_file = argv[a] + 8;
+        } else if (strcmp(argv[a], "--approx") == 0) {
+            opts->approx_bits = DEFAULT_APPROX_BITS;
+        } else if (strncmp(argv[a], "--approx=", 9) == 0) {
+            opts->approx_bits = atoi(argv[a] + 9);
+            if (opts->approx_bits < MIN_APPROX_BITS || opts->approx_bits > MAX_APPROX_BITS) {
+                if (world_rank == 0) {
+                    printf("Error: --approx bits must be between %d and %d\n",
+                           MIN_APPROX_BITS, MAX_APPROX_BITS);
+                    fflush(stdout);
+                }
+                return false;
+            }
+        } else if (strncmp(argv[a], "--", 2) == 0) {
+            if (world_rank == 0) {
+                printf("Error: unknown option '%s'\n", argv[a]);
+                fflush(stdout);
+            }
+            return false;
+        } else {
+            opts->N = atoll(argv[a]);
+            have_n = true;
+
+            // Verify N is within reasonable bounds
+            if (opts->N <= 0) {
+                if (world_rank == 0) {
+                    printf("Error: N must be positive\n");
+                    fflush(stdout);
                 }
+                return false;
             }
         }
-        
-        end_time = MPI_Wtime();
-        
-        // Print results with total products for comparison
-        // Use format specifiers for int64_t
-        printf("M(%" PRId64 ") = %" PRId64 "\n", N, global_unique_count);
-        printf("Total products in table: %" PRId64 "\n", (int64_t)N * (int64_t)N);
-        printf("Percentage of unique products: %.2f%%\n", 
-               (double)global_unique_count / ((double)N * (double)N) * 100.0);
-        printf("Time elapsed: %.6f seconds\n", end_time - start_time);
+    }
+
+    // Checkpoints track one contiguous share per process of a plain hash set
+    if ((opts->checkpoint_dir != NULL || opts->resume)
+        && (opts->checkpoint_dir == NULL || opts->engine != ENGINE_HASH
+            || opts->schedule != SCHED_STATIC || opts->spill_dir != NULL)) {
+        if (world_rank == 0) {
+            printf("Error: --checkpoint-dir/--resume need --checkpoint-dir with the hash engine, "
+                   "static schedule and no --spill-dir\n");
+            fflush(stdout);
+        }
+        return false;
+    }
+
+    // The merge engine merges all of a process's rows at once, so it needs the
+    // process's whole share up front, and the shared engine deals out its
+    // segments and rows by node and process
+    if ((opts->engine == ENGINE_MERGE || opts->engine == ENGINE_SHARED)
+        && opts->schedule != SCHED_STATIC) {
+        if (world_rank == 0) {
+            printf("Error: --engine=%s needs the static schedule\n", engine_names[opts->engine]);
+            fflush(stdout);
+        }
+        return false;
+    }
+
+    // Streaming replaces the whole fill-then-combine flow of the hash engine
+    if (opts->dedup == DEDUP_STREAM
+        && (opts->engine != ENGINE_HASH || opts->spill_dir != NULL || opts->checkpoint_dir != NULL)) {
+        if (world_rank == 0) {
+            printf("Error: --dedup=stream needs the hash engine without --spill-dir or --checkpoint-dir\n");
+            fflush(stdout);
+        }
+        return false;
+    }
+
+    // The sketch replaces the engine, so only the schedule applies to it
+    if (opts->approx_bits > 0
+        && (engine_given || dedup_given || opts->sweep_step > 0
+            || opts->spill_dir != NULL || opts->checkpoint_dir != NULL)) {
+        if (world_rank == 0) {
+            printf("Error: --approx cannot be combined with --engine, --dedup, --sweep, "
+                   "--spill-dir or --checkpoint-dir\n");
+            fflush(stdout);
+        }
+        return false;
+    }
+
+    // So does the sweep's own bitmap pass
+    if (opts->sweep_step > 0 && (engine_given || dedup_given || opts->checkpoint_dir != NULL)) {
+        if (world_rank == 0) {
+            printf("Error: --sweep cannot be combined with --engine, --dedup or --checkpoint-dir\n");
+            fflush(stdout);
+        }
+        return false;
+    }
+
+    // Spilling replaces the hash engine's set and its exchange with run files
+    if (opts->spill_dir != NULL
+        && (opts->engine != ENGINE_HASH || dedup_given || opts->sweep_step > 0)) {
+        if (world_rank == 0) {
+            printf("Error: --spill-dir needs the hash engine, and cannot be combined with "
+                   "--dedup or --sweep\n");
+            fflush(stdout);
+        }
+        return false;
+    }
+
+    // The bitmap, divisor and shared engines only sum per-process counts, so
+    // there is no set exchange for a dedup strategy to choose
+    if (dedup_given
+        && (opts->engine == ENGINE_BITMAP || opts->engine == ENGINE_DIVISOR
+            || opts->engine == ENGINE_SHARED)) {
+        if (world_rank == 0) {
+            printf("Error: --dedup needs the hash, swiss, hybrid or merge engine\n");
+            fflush(stdout);
+        }
+        return false;
+    }
+
+    // The index is written from the union process 0 ends up merging, which only
+    // the set engines produce and only gather and tree bring to one process
+    if (opts->index_file != NULL
+        && (opts->approx_bits > 0 || opts->sweep_step > 0 || opts->spill_dir != NULL
+            || opts->engine == ENGINE_BITMAP || opts->engine == ENGINE_DIVISOR
+            || opts->engine == ENGINE_SHARED
+            || (opts->dedup != DEDUP_GATHER && opts->dedup != DEDUP_TREE))) {
+        if (world_rank == 0) {
+            printf("Error: --index needs the hash, swiss, hybrid or merge engine with "
+                   "--dedup=gather or tree, and no --spill-dir, --sweep or --approx\n");
+            fflush(stdout);
+        }
+        return false;
+    }
+
+    // A batch answers many tables; checkpoints, a sweep and an index each
+    // describe exactly one
+    bool batch = opts->batch_count > 0 || opts->batch_file != NULL;
+    if (batch && (opts->checkpoint_dir != NULL || opts->sweep_step > 0 || opts->index_file != NULL)) {
+        if (world_rank == 0) {
+            printf("Error: --batch cannot be combined with --checkpoint-dir, --sweep or --index\n");
+            fflush(stdout);
+        }
+        return false;
+    }
+    // Other shapes go through the engines that walk pair (or triple) ranges.
+    // Three factors are only walked by the plain hash engine.
+    bool pair_engine = opts->engine == ENGINE_HASH || opts->engine == ENGINE_SWISS
+        || opts->engine == ENGINE_HYBRID || opts->engine == ENGINE_MERGE;
+    if (opts->rows > 0
+        && (opts->factors == 3 || !pair_engine || opts->sweep_step > 0
+            || opts->index_file != NULL || batch || !have_n)) {
+        if (world_rank == 0) {
+            printf("Error: --rows needs N and the hash, swiss, hybrid or merge engine, and "
+                   "cannot be combined with --factors=3, --sweep, --index or --batch\n");
+            fflush(stdout);
+        }
+        return false;
+    }
+    if (opts->factors == 3
+        && (opts->engine != ENGINE_HASH || opts->dedup == DEDUP_STREAM || opts->spill_dir != NULL
+            || opts->checkpoint_dir != NULL || opts->approx_bits > 0 || opts->sweep_step > 0
+            || opts->index_file != NULL)) {
+        if (world_rank == 0) {
+            printf("Error: --factors=3 needs the hash engine with --dedup=gather, alltoall or tree, "
+                   "and no --spill-dir, --checkpoint-dir, --approx, --sweep or --index\n");
+            fflush(stdout);
+        }
+        return false;
+    }
+    // i*j*k has to fit in 64 bits (batch values are checked by load_batch)
+    if (opts->factors == 3 && opts->N > FACTORS3_MAX_N) {
+        if (world_rank == 0) {
+            printf("Error: --factors=3 supports N up to %d\n", FACTORS3_MAX_N);
+            fflush(stdout);
+        }
+        return false;
+    }
+    // A table with more rows than columns is its own transpose
+    if (opts->rows >= opts->N) {
+        int64_t columns = opts->rows;
+        opts->rows = (opts->rows == opts->N) ? 0 : opts->N;
+        opts->N = columns;
+    }
+
+    if (batch && have_n) {
+        opts->batch = (int64_t*)realloc(opts->batch, (opts->batch_count + 1) * sizeof(int64_t));
+        opts->batch[opts->batch_count++] = opts->N;
+    }
+
+    if (!have_n && !batch && world_rank == 0) {
+        printf("No value provided for N, using default N=10\n");
         fflush(stdout);
-        
-        // Free memory
-        free(all_products);
-        free(displacements);
-        free(all_counts);
-    } else {
-        // Non-root processes just send their data
-        MPI_Gatherv(local_unique_products, local_count_int, MPI_LONG_LONG, 
-                   NULL, NULL, NULL, 
-                   MPI_LONG_LONG, 0, MPI_COMM_WORLD);
-    }
-    
-    // Clean up
-    free(local_unique_products);
-    hashset_free(&unique_products);
-    
-    MPI_Finalize();
-    return 0;
-} 
\ No newline at end of file
+    }
+    return true;
+}
+
+// Abort all processes if a per-message count no longer fits MPI's int counts
+void check_mpi_count(int64_t count, const char* what) {
+    if (count > INT_MAX) {
+        fprintf(stderr, "Error: %s of %" PRId64 " elements exceeds MPI int count limit\n",
+                what, count);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+}
+
+// Receives one contiguous range of pair indexes to process
+typedef void (*PairRangeFn)(void* ctx, int64_t N, int64_t start_idx, int64_t end_idx);
+
+// Hand every range of pairs assigned to this process to fn: one fixed share
+// under the static schedule, or blocks claimed from the shared counter until
+// the whole triangle is handed out under the dynamic one
+void for_each_assigned_range(const Options* opts, int world_rank, int world_size,
+                             PairRangeFn fn, void* ctx) {
+    int64_t N = opts->N;
+    int64_t total_pairs = table_items(opts);
+
+    if (opts->schedule == SCHED_DYNAMIC) {
+        int64_t block = sched_block_pairs(total_pairs, world_size);
+        WorkCounter counter;
+        work_counter_init(&counter, world_rank);
+
+        int64_t start_idx;
+        while ((start_idx = work_counter_next(&counter, block)) < total_pairs) {
+            int64_t end_idx = start_idx + block - 1;
+            if (end_idx > total_pairs - 1) end_idx = total_pairs - 1;
+            fn(ctx, N, start_idx, end_idx);
+        }
+
+        work_counter_free(&counter);
+    } else {
+        int64_t start_idx, end_idx;
+        partition_range(total_pairs, world_rank, world_size, &start_idx, &end_idx);
+        if (start_idx <= end_idx) {
+            fn(ctx, N, start_idx, end_idx);
+        }
+    }
+}
+
+// Exact number of distinct products among the pair indexes start_idx..end_idx
+// of the N-table, counted in a bitmap over [1, N*N]. Only used for small N.
+int64_t count_distinct_in_range(int64_t N, int64_t start_idx, int64_t end_idx) {
+    int64_t words = (N * N) / 64 + 1;
+    uint64_t* bits = (uint64_t*)calloc(words, sizeof(uint64_t));
+    PairSpan span = pair_span(N, start_idx, end_idx);
+
+    for (int64_t i = span.first_i; i <= span.last_i; i++) {
+        int64_t j_first = (i == span.first_i) ? span.first_j : i;
+        int64_t j_last = (i == span.last_i) ? span.last_j : N;
+        for (int64_t j = j_first; j <= j_last; j++) {
+            int64_t product = i * j;
+            bits[product >> 6] |= 1ULL << (product & 63);
+        }
+    }
+
+    int64_t distinct = 0;
+    for (int64_t w = 0; w < words; w++) {
+        distinct += __builtin_popcountll(bits[w]);
+    }
+    free(bits);
+    return distinct;
+}
+
+// Estimate the distinct products among the pair indexes start_idx..end_idx.
+// The same relative slice of an ESTIMATE_SAMPLE_N table is counted exactly
+// and its distinct-per-pair ratio is applied to the real slice. Like
+// M(N)/N^2 in the README table, that ratio drifts only slowly as N grows, so
+// ESTIMATE_MARGIN of headroom covers it.
+int64_t estimate_distinct_products(int64_t N, int64_t start_idx, int64_t end_idx) {
+    int64_t pairs = end_idx - start_idx + 1;
+    if (pairs <= 0) return 0;
+    if (N <= ESTIMATE_SAMPLE_N) return count_distinct_in_range(N, start_idx, end_idx);
+
+    int64_t n = ESTIMATE_SAMPLE_N;
+    double scale = (double)((n * (n + 1)) / 2) / (double)((N * (N + 1)) / 2);
+    int64_t sample_start = (int64_t)(start_idx * scale);
+    int64_t sample_end = (int64_t)((end_idx + 1) * scale) - 1;
+    if (sample_end < sample_start) sample_end = sample_start;
+
+    double ratio = (double)count_distinct_in_range(n, sample_start, sample_end)
+                 / (double)(sample_end - sample_start + 1);
+    int64_t estimate = (int64_t)(pairs * ratio * ESTIMATE_MARGIN);
+    return estimate < pairs ? estimate : pairs;
+}
+
+// Expected number of distinct products this process will insert: the
+// estimate for its own share under the static schedule, and the mean over
+// all shares under the dynamic one, where blocks land on any process
+int64_t estimate_local_distinct(const Options* opts, int world_rank, int world_size) {
+    int64_t N = opts->N;
+    int64_t start_idx, end_idx;
+
+    // The sample only models the square triangle. Other shapes start from a
+    // fixed fraction of their share (three factors repeat far more) and let
+    // the set grow from there.
+    if (opts->rows > 0 || opts->factors == 3) {
+        int64_t share = table_items(opts) / world_size + 1;
+        return share / (opts->factors == 3 ? 16 : 4);
+    }
+
+    if (opts->schedule == SCHED_DYNAMIC) {
+        int64_t sum = 0;
+        for (int r = 0; r < world_size; r++) {
+            partition_range((N * (N + 1)) / 2, r, world_size, &start_idx, &end_idx);
+            sum += estimate_distinct_products(N, start_idx, end_idx);
+        }
+        return sum / world_size;
+    }
+
+    partition_range((N * (N + 1)) / 2, world_rank, world_size, &start_idx, &end_idx);
+    return estimate_distinct_products(N, start_idx, end_idx);
+}
+
+// Print a progress line once every process has finished its local computation
+void report_local_done(int world_rank, int world_size) {
+    phase_lap(PHASE_GENERATE);
+    int local_done = 1;
+    int all_done = 0;
+    MPI_Allreduce(&local_done, &all_done, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+
+    if (world_rank == 0 && all_done == world_size) {
+        printf("All processes have computed their unique products\n");
+        fflush(stdout);
+    }
+    phase_lap(PHASE_WAIT);
+}
+
+// Append v as a little-endian base-128 varint, returns bytes written
+int write_varint(uint8_t* out, uint64_t v) {
+    int n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+// Bytes write_varint uses for v
+static inline int varint_size(uint64_t v) {
+    int n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+// Wire format for sorted unique sets sent between processes: each value is
+// the varint of its gap from the previous value (the first from 0). Gaps
+// between distinct products are small, so most values take one or two bytes
+// instead of eight. The encoded bytes go out in messages of at most
+// WIRE_CHUNK_BYTES, so no MPI count overflows however large the set is.
+typedef struct {
+    uint8_t* bytes;
+    int64_t size;    // encoded bytes
+    int64_t count;   // values
+} EncodedRun;
+
+// Send an encoded run to dest: its count and size, then the bytes in chunks
+void send_encoded_run(const EncodedRun* run, int dest) {
+    int64_t header[2] = {run->count, run->size};
+    MPI_Send(header, 2, MPI_LONG_LONG, dest, WIRE_TAG_HEADER, MPI_COMM_WORLD);
+    for (int64_t offset = 0; offset < run->size; offset += WIRE_CHUNK_BYTES) {
+        int64_t chunk = run->size - offset;
+        if (chunk > WIRE_CHUNK_BYTES) chunk = WIRE_CHUNK_BYTES;
+        MPI_Send(run->bytes + offset, (int)chunk, MPI_BYTE, dest, WIRE_TAG_DATA, MPI_COMM_WORLD);
+    }
+}
+
+// Receive an encoded run sent by send_encoded_run from source
+void recv_encoded_run(EncodedRun* run, int source) {
+    int64_t header[2];
+    MPI_Recv(header, 2, MPI_LONG_LONG, source, WIRE_TAG_HEADER, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    run->count = header[0];
+    run->size = header[1];
+    run->bytes = (uint8_t*)malloc(run->size > 0 ? run->size : 1);
+    for (int64_t offset = 0; offset < run->size; offset += WIRE_CHUNK_BYTES) {
+        int64_t chunk = run->size - offset;
+        if (chunk > WIRE_CHUNK_BYTES) chunk = WIRE_CHUNK_BYTES;
+        MPI_Recv(run->bytes + offset, (int)chunk, MPI_BYTE, source, WIRE_TAG_DATA,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    }
+}
+
+// Read one varint and advance *pos past it
+static inline uint64_t read_varint(const uint8_t** pos) {
+    uint64_t v = 0;
+    int shift = 0;
+    uint8_t b;
+    do {
+        b = *(*pos)++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return v;
+}
+
+// Sequential decoder over a delta + varint run, either an EncodedRun in
+// memory or a section of a file read through a buffer. A run in memory is
+// one buffer that is never refilled.
+typedef struct {
+    FILE* file;          // NULL for a run in memory
+    int64_t remaining;   // values left after the current one
+    int64_t value;       // current value
+    uint8_t* buffer;
+    size_t pos, len;
+} RunReader;
+
+// Next byte of the run, refilling the buffer from the file as needed
+static inline int run_reader_byte(RunReader* reader) {
+    if (reader->pos == reader->len) {
+        if (reader->file == NULL) return -1;
+        reader->len = fread(reader->buffer, 1, RUN_IO_BUFFER, reader->file);
+        reader->pos = 0;
+        if (reader->len == 0) return -1;
+    }
+    return reader->buffer[reader->pos++];
+}
+
+// Advance to the next value, returns false at the end of the run
+bool run_reader_next(RunReader* reader) {
+    if (reader->remaining == 0) return false;
+
+    uint64_t delta = 0;
+    if (reader->len - reader->pos >= 10) {
+        // A whole varint is buffered, so decode it in place
+        const uint8_t* pos = reader->buffer + reader->pos;
+        delta = read_varint(&pos);
+        reader->pos = (size_t)(pos - reader->buffer);
+    } else {
+        int shift = 0;
+        int byte;
+        do {
+            byte = run_reader_byte(reader);
+            if (byte < 0) return false;
+            delta |= (uint64_t)(byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+    }
+
+    reader->value += (int64_t)delta;
+    reader->remaining--;
+    return true;
+}
+
+// Position a reader on the first value of a run in memory, returns false if
+// it is empty
+bool run_reader_open_bytes(RunReader* reader, const EncodedRun* run) {
+    reader->file = NULL;
+    reader->buffer = run->bytes;
+    reader->pos = 0;
+    reader->len = (size_t)run->size;
+    reader->value = 0;
+    reader->remaining = run->count;
+    return run_reader_next(reader);
+}
+
+// Read count values from the current position of file, which the reader
+// takes over, and load the first one. Returns false if there is none.
+bool run_reader_start(RunReader* reader, FILE* file, int64_t count) {
+    reader->file = file;
+    reader->buffer = (uint8_t*)malloc(RUN_IO_BUFFER);
+    reader->pos = 0;
+    reader->len = 0;
+    reader->value = 0;
+    reader->remaining = count;
+    return run_reader_next(reader);
+}
+
+// Release the reader's file and buffer; a reader over memory owns neither
+void run_reader_close(RunReader* reader) {
+    if (reader->file == NULL) return;
+    fclose(reader->file);
+    free(reader->buffer);
+}
+
+// Restore the min-heap property below slot k of a heap of readers keyed on value
+void reader_heap_down(RunReader** heap, int size, int k) {
+    while (true) {
+        int smallest = k;
+        int left = 2 * k + 1, right = 2 * k + 2;
+        if (left < size && heap[left]->value < heap[smallest]->value) smallest = left;
+        if (right < size && heap[right]->value < heap[smallest]->value) smallest = right;
+        if (smallest == k) return;
+
+        RunReader* tmp = heap[k];
+        heap[k] = heap[smallest];
+        heap[smallest] = tmp;
+        k = smallest;
+    }
+}
+
+// k-way merge of the readers in heap, each on its first value, counting
+// values that differ from the last value taken from any reader. Each counted
+// value is also appended to index unless it is NULL.
+int64_t merge_readers(RunReader** heap, int heap_size, ProductIndexWriter* index) {
+    for (int k = heap_size / 2 - 1; k >= 0; k--) {
+        reader_heap_down(heap, heap_size, k);
+    }
+
+    int64_t unique_count = 0;
+    int64_t last = 0;  // products are positive, so 0 never matches
+    while (heap_size > 0) {
+        RunReader* top = heap[0];
+        if (top->value != last) {
+            unique_count++;
+            last = top->value;
+            if (index != NULL) product_index_writer_add(index, (uint64_t)last);
+        }
+        if (!run_reader_next(top)) {
+            heap[0] = heap[--heap_size];
+        }
+        reader_heap_down(heap, heap_size, 0);
+    }
+    return unique_count;
+}
+
+// k-way merge of encoded runs straight from their bytes, counting distinct
+// values and appending them to index unless it is NULL
+int64_t merge_encoded_runs(const EncodedRun* runs, int run_count, ProductIndexWriter* index) {
+    RunReader* readers = (RunReader*)malloc((run_count > 0 ? run_count : 1) * sizeof(RunReader));
+    RunReader** heap = (RunReader**)malloc((run_count > 0 ? run_count : 1) * sizeof(RunReader*));
+    int heap_size = 0;
+
+    for (int r = 0; r < run_count; r++) {
+        if (run_reader_open_bytes(&readers[r], &runs[r])) {
+            heap[heap_size++] = &readers[r];
+        }
+    }
+    int64_t unique_count = merge_readers(heap, heap_size, index);
+
+    free(heap);
+    free(readers);
+    return unique_count;
+}
+
+// Open the --index file on process 0 and write the values 1..N of row 1,
+// which the engines never generate. Returns NULL when this process writes no
+// index.
+ProductIndexWriter* open_index_output(ProductIndexWriter* writer, const Options* opts,
+                                      int world_rank) {
+    if (opts->index_file == NULL || world_rank != 0) return NULL;
+    if (!product_index_writer_open(writer, opts->index_file, (uint64_t)opts->N)) {
+        printf("Warning: cannot write %s, the index is not saved\n", opts->index_file);
+        fflush(stdout);
+        return NULL;
+    }
+
+    for (int64_t v = 1; v <= opts->N; v++) {
+        product_index_writer_add(writer, (uint64_t)v);
+    }
+    return writer;
+}
+
+// Finish an index opened by open_index_output (a no-op for NULL)
+void close_index_output(ProductIndexWriter* writer, const Options* opts) {
+    if (writer == NULL) return;
+    if (product_index_writer_close(writer)) {
+        printf("Wrote the distinct products to %s\n", opts->index_file);
+    } else {
+        printf("Warning: writing %s failed, the index is incomplete\n", opts->index_file);
+    }
+    fflush(stdout);
+}
+
+// Merge engine cursor over one row: the row's next product, the step to the
+// one after it and the row's last product
+typedef struct {
+    int64_t value;
+    int64_t step;
+    int64_t last;
+} RowCursor;
+
+// Move heap[k] down to its place in a min-heap of row cursors, shifting the
+// smaller children up into the hole instead of swapping
+void row_heap_down(RowCursor* heap, int64_t size, int64_t k) {
+    RowCursor moving = heap[k];
+    while (true) {
+        int64_t child = 2 * k + 1;
+        if (child >= size) break;
+        if (child + 1 < size && heap[child + 1].value < heap[child].value) child++;
+        if (heap[child].value >= moving.value) break;
+        heap[k] = heap[child];
+        k = child;
+    }
+    heap[k] = moving;
+}
+
+// Add a cursor to a min-heap of row cursors holding size cursors
+void row_heap_push(RowCursor* heap, int64_t* size, RowCursor cursor) {
+    int64_t k = (*size)++;
+    while (k > 0 && heap[(k - 1) / 2].value > cursor.value) {
+        heap[k] = heap[(k - 1) / 2];
+        k = (k - 1) / 2;
+    }
+    heap[k] = cursor;
+}
+
+// qsort order of row cursors by their first product
+int compare_row_start(const void* a, const void* b) {
+    int64_t va = ((const RowCursor*)a)->value;
+    int64_t vb = ((const RowCursor*)b)->value;
+    return (va > vb) - (va < vb);
+}
+
+// Nonblocking sends still in flight in the streaming dedup, with the buffers
+// they send from
+typedef struct {
+    MPI_Request* requests;
+    uint8_t** buffers;
+    int count;
+    int capacity;
+} PendingSends;
+
+// Start sending size bytes to dest; the buffer is freed once the send completes
+void pending_sends_post(PendingSends* pending, uint8_t* bytes, int64_t size, int dest, int tag) {
+    if (pending->count == pending->capacity) {
+        pending->capacity = pending->capacity > 0 ? pending->capacity * 2 : 64;
+        pending->requests = (MPI_Request*)realloc(pending->requests,
+                                                  pending->capacity * sizeof(MPI_Request));
+        pending->buffers = (uint8_t**)realloc(pending->buffers, pending->capacity * sizeof(uint8_t*));
+    }
+    check_mpi_count(size, "Stream chunk");
+    MPI_Isend(bytes, (int)size, MPI_BYTE, dest, tag, MPI_COMM_WORLD,
+              &pending->requests[pending->count]);
+    pending->buffers[pending->count++] = bytes;
+}
+
+// Free the buffers of completed sends (of all sends when wait is true)
+void pending_sends_reap(PendingSends* pending, bool wait) {
+    int kept = 0;
+    for (int k = 0; k < pending->count; k++) {
+        int done = 1;
+        if (wait) {
+            MPI_Wait(&pending->requests[k], MPI_STATUS_IGNORE);
+        } else {
+            MPI_Test(&pending->requests[k], &done, MPI_STATUS_IGNORE);
+        }
+        if (done) {
+            free(pending->buffers[k]);
+        } else {
+            pending->requests[kept] = pending->requests[k];
+            pending->buffers[kept++] = pending->buffers[k];
+        }
+    }
+    pending->count = kept;
+}
+
+// Key-width instantiations of the hash engine: 64-bit keys under the plain
+// names, and 32-bit keys, which halve the set, arrays and messages, for any
+// table whose products fit (up to KEY32_MAX_PRODUCT)
+#define KEY_T int64_t
+#define KEY_MAX INT64_MAX
+#define KEY_MPI MPI_LONG_LONG
+#define KEY_FN(name) name
+#include "product_set.h"
+
+#define KEY_T uint32_t
+#define KEY_MAX UINT32_MAX
+#define KEY_MPI MPI_UNSIGNED
+#define KEY_FN(name) name##32
+#include "product_set.h"
+
+// Out-of-core mode. When a process's hash set reaches its memory budget the
+// set is sorted and written to a run file in the spill directory, then
+// emptied. Every run file is cut into world_size sections by equal-width
+// slices of [1, N*N] and each section is stored delta + varint encoded.
+// After all products are spilled, process r streams section r of every
+// run from every process through a k-way merge, so the spill directory must
+// be visible to all processes (local disk on a single node, or a shared
+// filesystem).
+//
+// Run file layout (native byte order):
+//   "MTRUN001"                        8-byte magic
+//   uint32_t sections
+//   uint64_t count[sections]          values per section
+//   uint64_t offset[sections]         byte offset of each section's data
+//   varint deltas                     each section starts from 0
+
+// Hash set that spills sorted runs to disk instead of growing past a budget
+typedef struct {
+    HashSet set;
+    int64_t set_size;       // buckets the set is (re)initialized with
+    int64_t budget_buckets; // buckets the set may hold, including while it grows
+    const char* dir;
+    int world_rank;
+    int world_size;
+    int64_t max_value;
+    int runs;
+} SpillingHashSet;
+
+// Path of run number run written by process rank
+void run_file_path(char* path, size_t path_size, const char* dir, int rank, int run) {
+    snprintf(path, path_size, "%s/mtable_r%d_run%d.bin", dir, rank, run);
+}
+
+// Abort all processes when a run file cannot be read or written
+void check_run_io(bool ok, const char* what, const char* path) {
+    if (!ok) {
+        fprintf(stderr, "Error: cannot %s run file '%s'\n", what, path);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+}
+
+// Smallest value owned by merge section r: sections are equal-width slices of [1, max_value]
+int64_t section_start(int64_t max_value, int r, int sections) {
+    return 1 + (max_value / sections) * r + (r < max_value % sections ? r : max_value % sections);
+}
+
+// Write a sorted array of distinct values as one run file
+void write_run(const char* path, const int64_t* values, int64_t count,
+               int64_t max_value, int sections) {
+    FILE* file = fopen(path, "wb");
+    check_run_io(file != NULL, "create", path);
+
+    uint64_t* section_counts = (uint64_t*)calloc(sections, sizeof(uint64_t));
+    uint64_t* section_offsets = (uint64_t*)calloc(sections, sizeof(uint64_t));
+    uint32_t section_total = (uint32_t)sections;
+
+    // Header first with placeholder tables, rewritten once the sizes are known
+    uint64_t offset = 8 + sizeof(uint32_t) + 2 * sections * sizeof(uint64_t);
+    bool ok = fwrite("MTRUN001", 1, 8, file) == 8
+           && fwrite(&section_total, sizeof(uint32_t), 1, file) == 1
+           && fwrite(section_counts, sizeof(uint64_t), sections, file) == (size_t)sections
+           && fwrite(section_offsets, sizeof(uint64_t), sections, file) == (size_t)sections;
+
+    uint8_t* buffer = (uint8_t*)malloc(RUN_IO_BUFFER + 10);
+    size_t used = 0;
+    int64_t k = 0;
+    for (int r = 0; r < sections; r++) {
+        int64_t section_end = (r == sections - 1) ? INT64_MAX : section_start(max_value, r + 1, sections);
+        section_offsets[r] = offset;
+
+        int64_t previous = 0;
+        while (k < count && values[k] < section_end) {
+            int n = write_varint(buffer + used, (uint64_t)(values[k] - previous));
+            used += n;
+            offset += n;
+            previous = values[k];
+            section_counts[r]++;
+            k++;
+
+            if (used >= RUN_IO_BUFFER) {
+                ok = ok && fwrite(buffer, 1, used, file) == used;
+                used = 0;
+            }
+        }
+    }
+    ok = ok && fwrite(buffer, 1, used, file) == used;
+
+    ok = ok && fseek(file, 8 + sizeof(uint32_t), SEEK_SET) == 0
+            && fwrite(section_counts, sizeof(uint64_t), sections, file) == (size_t)sections
+            && fwrite(section_offsets, sizeof(uint64_t), sections, file) == (size_t)sections;
+    ok = (fclose(file) == 0) && ok;
+    check_run_io(ok, "write", path);
+
+    free(buffer);
+    free(section_offsets);
+    free(section_counts);
+}
+
+// Open section `section` of a run file and load its first value.
+// Returns false if the section is empty.
+bool run_reader_open(RunReader* reader, const char* path, int section) {
+    reader->file = fopen(path, "rb");
+    check_run_io(reader->file != NULL, "open", path);
+
+    char magic[8];
+    uint32_t sections = 0;
+    uint64_t count = 0, offset = 0;
+    bool ok = fread(magic, 1, 8, reader->file) == 8 && memcmp(magic, "MTRUN001", 8) == 0
+           && fread(&sections, sizeof(uint32_t), 1, reader->file) == 1
+           && (uint32_t)section < sections
+           && fseek(reader->file, 8 + sizeof(uint32_t) + section * sizeof(uint64_t), SEEK_SET) == 0
+           && fread(&count, sizeof(uint64_t), 1, reader->file) == 1
+           && fseek(reader->file, 8 + sizeof(uint32_t) + (sections + section) * sizeof(uint64_t), SEEK_SET) == 0
+           && fread(&offset, sizeof(uint64_t), 1, reader->file) == 1
+           && fseek(reader->file, (long)offset, SEEK_SET) == 0;
+    check_run_io(ok, "read", path);
+    return run_reader_start(reader, reader->file, (int64_t)count);
+}
+
+// k-way merge of one section from every run, counting distinct values
+int64_t merge_run_section(char** paths, int path_count, int section) {
+    RunReader* readers = (RunReader*)malloc((path_count > 0 ? path_count : 1) * sizeof(RunReader));
+    RunReader** heap = (RunReader**)malloc((path_count > 0 ? path_count : 1) * sizeof(RunReader*));
+    int heap_size = 0;
+
+    for (int p = 0; p < path_count; p++) {
+        if (run_reader_open(&readers[p], paths[p], section)) {
+            heap[heap_size++] = &readers[p];
+        }
+    }
+    int64_t unique_count = merge_readers(heap, heap_size, NULL);
+
+    for (int p = 0; p < path_count; p++) {
+        run_reader_close(&readers[p]);
+    }
+    free(heap);
+    free(readers);
+    return unique_count;
+}
+
+// Sort the set's contents into a new run file and empty the set
+void spilling_hashset_flush(SpillingHashSet* spill) {
+    if (spill->set.count == 0) return;
+
+    int64_t count;
+    int64_t* values = hashset_to_array(&spill->set, &count);
+    hashset_free(&spill->set);
+
+    int64_t* scratch = (int64_t*)malloc(count * sizeof(int64_t));
+    radix_sort(values, count, scratch);
+    free(scratch);
+
+    char path[4096];
+    run_file_path(path, sizeof(path), spill->dir, spill->world_rank, spill->runs++);
+    write_run(path, values, count, spill->max_value, spill->world_size);
+    free(values);
+
+    hashset_init(&spill->set, spill->set_size);
+}
+
+// PairRangeFn: add the products of the range, spilling whenever the set is full
+void spilling_hashset_add_range(void* ctx, int64_t N, int64_t start_idx, int64_t end_idx) {
+    SpillingHashSet* spill = (SpillingHashSet*)ctx;
+    PairSpan span = pair_span(N, start_idx, end_idx);
+
+    for (int64_t i = span.first_i; i <= span.last_i; i++) {
+        int64_t j_first = covered_row_start(N, i, (i == span.first_i) ? span.first_j : i);
+        int64_t j_last = (i == span.last_i) ? span.last_j : N;
+        for (int64_t j = j_first; j <= j_last; j++) {
+            // A growing segment holds its old and doubled buckets at once
+            int64_t growth = hashset_growth(&spill->set, i * j);
+            if (growth > 0 && spill->set.size + 2 * growth > spill->budget_buckets) {
+                spilling_hashset_flush(spill);
+            }
+            hashset_add(&spill->set, i * j);
+        }
+    }
+}
+
+// Hash engine for tables whose distinct products do not fit in memory: the
+// per-process set is capped at the memory budget and spilled to sorted runs,
+// then each process merges its value section of every run.
+// Returns M(N) on process 0 and 0 elsewhere.
+int64_t external_hash_engine_count(const Options* opts, int world_rank, int world_size) {
+    int64_t N = opts->N;
+
+    SpillingHashSet spill;
+    spill.dir = opts->spill_dir;
+    spill.world_rank = world_rank;
+    spill.world_size = world_size;
+    spill.max_value = N * N;
+    spill.runs = 0;
+
+    // The budget buys this many buckets. The set starts at the expected size
+    // and its segments grow until a growth would pass the budget, which
+    // spills instead.
+    spill.budget_buckets = opts->memory_mb * 1024 * 1024 / (int64_t)sizeof(int64_t);
+    int64_t expected_unique = estimate_local_distinct(opts, world_rank, world_size);
+    spill.set_size = (int64_t)(expected_unique / LOAD_FACTOR_THRESHOLD) + 1;
+    if (spill.set_size > spill.budget_buckets) spill.set_size = spill.budget_buckets;
+    if (spill.set_size < 1024) spill.set_size = 1024;
+
+    hashset_init(&spill.set, spill.set_size);
+    for_each_assigned_range(opts, world_rank, world_size, spilling_hashset_add_range, &spill);
+    spilling_hashset_flush(&spill);
+    hashset_free(&spill.set);
+
+    // Signal completion of local computation
+    report_local_done(world_rank, world_size);
+
+    // Every process needs the list of every process's runs
+    int* run_counts = (int*)malloc(world_size * sizeof(int));
+    MPI_Allgather(&spill.runs, 1, MPI_INT, run_counts, 1, MPI_INT, MPI_COMM_WORLD);
+
+    int path_count = 0;
+    for (int r = 0; r < world_size; r++) {
+        path_count += run_counts[r];
+    }
+    if (world_rank == 0) {
+        printf("Merging %d spilled runs\n", path_count);
+        fflush(stdout);
+    }
+
+    char** paths = (char**)malloc((path_count > 0 ? path_count : 1) * sizeof(char*));
+    int p = 0;
+    for (int r = 0; r < world_size; r++) {
+        for (int run = 0; run < run_counts[r]; run++) {
+            paths[p] = (char*)malloc(4096);
+            run_file_path(paths[p], 4096, opts->spill_dir, r, run);
+            p++;
+        }
+    }
+
+    int64_t section_unique_count = merge_run_section(paths, path_count, world_rank);
+
+    int64_t global_unique_count = 0;
+    MPI_Reduce(&section_unique_count, &global_unique_count, 1, MPI_LONG_LONG,
+               MPI_SUM, 0, MPI_COMM_WORLD);
+
+    // Add back the values 1..N that no pair was generated for
+    if (world_rank == 0) global_unique_count += opts->N;
+
+    // Each process removes its own runs once every process is done reading
+    MPI_Barrier(MPI_COMM_WORLD);
+    for (int run = 0; run < spill.runs; run++) {
+        char path[4096];
+        run_file_path(path, sizeof(path), opts->spill_dir, world_rank, run);
+        remove(path);
+    }
+
+    for (int k = 0; k < path_count; k++) {
+        free(paths[k]);
+    }
+    free(paths);
+    free(run_counts);
+    return global_unique_count;
+}
+
+// Checkpoint/restart for the hash engine under the static schedule. Every
+// process periodically writes its own checkpoint to local disk: its frontier
+// (the first pair index of its share not yet inserted) and its unique set,
+// sorted and delta + varint encoded. The file is written under a temporary
+// name and renamed over the previous checkpoint, so a crash mid-write leaves
+// the last complete checkpoint in place. With --resume each process reloads
+// its checkpoint and continues from the frontier.
+//
+// Checkpoint file layout (native byte order):
+//   "MTCKPT01"                                  8-byte magic
+//   int64_t N, world_size, rank, frontier, end_idx, count
+//   varint deltas of the sorted set
+
+// Header fields of a checkpoint
+typedef struct {
+    int64_t N;
+    int64_t world_size;
+    int64_t rank;
+    int64_t frontier;
+    int64_t end_idx;
+    int64_t count;
+} CheckpointHeader;
+
+// Progress of a checkpointed share, handed to checkpointed_hashset_add_range
+typedef struct {
+    HashSet* set;
+    const char* dir;
+    int64_t N;
+    int world_rank;
+    int world_size;
+    int64_t end_idx;
+    double interval;
+    double last_saved;
+} CheckpointState;
+
+// Path of the checkpoint written by process rank
+void checkpoint_path(char* path, size_t path_size, const char* dir, int rank) {
+    snprintf(path, path_size, "%s/mtable_ckpt_r%d.bin", dir, rank);
+}
+
+// Write the set and frontier as this process's checkpoint
+void save_checkpoint(const CheckpointState* state, int64_t frontier) {
+    char path[4096], tmp_path[4160];
+    checkpoint_path(path, sizeof(path), state->dir, state->world_rank);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    int64_t count;
+    int64_t* values = hashset_to_array(state->set, &count);
+    int64_t* scratch = (int64_t*)malloc((count > 0 ? count : 1) * sizeof(int64_t));
+    radix_sort(values, count, scratch);
+    free(scratch);
+
+    FILE* file = fopen(tmp_path, "wb");
+    check_run_io(file != NULL, "create", tmp_path);
+
+    CheckpointHeader header = {state->N, state->world_size, state->world_rank,
+                               frontier, state->end_idx, count};
+    bool ok = fwrite("MTCKPT01", 1, 8, file) == 8
+           && fwrite(&header, sizeof(header), 1, file) == 1;
+
+    uint8_t* buffer = (uint8_t*)malloc(RUN_IO_BUFFER + 10);
+    size_t used = 0;
+    int64_t previous = 0;
+    for (int64_t k = 0; k < count; k++) {
+        used += write_varint(buffer + used, (uint64_t)(values[k] - previous));
+        previous = values[k];
+        if (used >= RUN_IO_BUFFER) {
+            ok = ok && fwrite(buffer, 1, used, file) == used;
+            used = 0;
+        }
+    }
+    ok = ok && fwrite(buffer, 1, used, file) == used;
+    ok = (fclose(file) == 0) && ok;
+    check_run_io(ok, "write", tmp_path);
+
+    // rename() does not replace an existing file on every platform
+    if (rename(tmp_path, path) != 0) {
+        remove(path);
+        check_run_io(rename(tmp_path, path) == 0, "rename", tmp_path);
+    }
+
+    free(buffer);
+    free(values);
+}
+
+// Load this process's checkpoint into the set. Returns the saved frontier, or
+// -1 when there is no checkpoint for this exact run (N, process count, share).
+int64_t load_checkpoint(const CheckpointState* state) {
+    char path[4096];
+    checkpoint_path(path, sizeof(path), state->dir, state->world_rank);
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return -1;
+
+    char magic[8];
+    CheckpointHeader header;
+    bool valid = fread(magic, 1, 8, file) == 8 && memcmp(magic, "MTCKPT01", 8) == 0
+              && fread(&header, sizeof(header), 1, file) == 1
+              && header.N == state->N && header.world_size == state->world_size
+              && header.rank == state->world_rank && header.end_idx == state->end_idx;
+    if (!valid) {
+        fclose(file);
+        return -1;
+    }
+
+    // The values follow the header in the run file encoding
+    RunReader reader;
+    int64_t loaded = 0;
+    for (bool more = run_reader_start(&reader, file, header.count); more;
+         more = run_reader_next(&reader)) {
+        hashset_add(state->set, reader.value);
+        loaded++;
+    }
+    run_reader_close(&reader);
+    check_run_io(loaded == header.count, "read", path);
+    return header.frontier;
+}
+
+// Add the products of the range row by row, checkpointing whenever the
+// interval has passed since the last save
+void checkpointed_hashset_add_range(CheckpointState* state, int64_t start_idx, int64_t end_idx) {
+    int64_t N = state->N;
+    PairSpan span = pair_span(N, start_idx, end_idx);
+
+    for (int64_t i = span.first_i; i <= span.last_i; i++) {
+        int64_t j_first = covered_row_start(N, i, (i == span.first_i) ? span.first_j : i);
+        int64_t j_last = (i == span.last_i) ? span.last_j : N;
+        for (int64_t j = j_first; j <= j_last; j++) {
+            hashset_add(state->set, i * j);
+        }
+
+        // The interval counts from the end of the previous save
+        if (i < span.last_i && MPI_Wtime() - state->last_saved >= state->interval) {
+            save_checkpoint(state, triangle_row_start(N, i + 1));
+            state->last_saved = MPI_Wtime();
+        }
+    }
+}
+
+// Fill the hash set with this process's static share, resuming from and
+// writing checkpoints. The finished share is checkpointed too, so a restart
+// during the merge skips the computation entirely.
+void checkpointed_hash_fill(HashSet* set, const Options* opts, int world_rank, int world_size) {
+    int64_t start_idx, end_idx;
+    partition_range(table_items(opts), world_rank, world_size, &start_idx, &end_idx);
+
+    CheckpointState state;
+    state.set = set;
+    state.dir = opts->checkpoint_dir;
+    state.N = opts->N;
+    state.world_rank = world_rank;
+    state.world_size = world_size;
+    state.end_idx = end_idx;
+    state.interval = opts->checkpoint_interval;
+    state.last_saved = MPI_Wtime();
+
+    int64_t frontier = start_idx;
+    if (opts->resume) {
+        int64_t saved = load_checkpoint(&state);
+        if (saved >= 0) {
+            frontier = saved;
+        }
+
+        int64_t resumed = (saved >= 0) ? 1 : 0;
+        int64_t total_resumed = 0;
+        MPI_Reduce(&resumed, &total_resumed, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        if (world_rank == 0) {
+            printf("Resumed %" PRId64 " of %d processes from checkpoints\n", total_resumed, world_size);
+            fflush(stdout);
+        }
+    }
+
+    if (frontier <= end_idx) {
+        checkpointed_hashset_add_range(&state, frontier, end_idx);
+        save_checkpoint(&state, end_idx + 1);
+    }
+}
+
+// Hash set engine: insert this process's share of the upper triangle into a
+// hash set, then combine the local sets with the selected dedup strategy.
+// Uses 32-bit keys when every product fits. Returns M(N) on process 0 and 0
+// elsewhere.
+int64_t hash_engine_count(const Options* opts, int world_rank, int world_size) {
+    if (opts->spill_dir != NULL) {
+        return external_hash_engine_count(opts, world_rank, world_size);
+    }
+    if (opts->dedup == DEDUP_STREAM) {
+        return table_fits_key32(opts) ? stream_hash_count32(opts, world_rank, world_size)
+                                        : stream_hash_count(opts, world_rank, world_size);
+    }
+
+    // A --batch run keeps its set between queries; when the key width
+    // changes, free the other width's set so the two are never held together
+    if (opts->checkpoint_dir == NULL && table_fits_key32(opts)) {
+        hashset_free(&batch_set);
+        return hash_set_count32(opts, world_rank, world_size, hash_fill_assigned32);
+    }
+    hashset_free32(&batch_set32);
+    if (opts->checkpoint_dir != NULL) {
+        return hash_set_count(opts, world_rank, world_size, checkpointed_hash_fill);
+    }
+    return hash_set_count(opts, world_rank, world_size, hash_fill_assigned);
+}
+
+// PairRangeFn: insert the products of the range into a SwissSet, a row
+// segment of up to SWISS_BATCH products at a time
+void swiss_add_range(void* ctx, int64_t N, int64_t start_idx, int64_t end_idx) {
+    SwissSet* set = (SwissSet*)ctx;
+    PairSpan span = pair_span(N, start_idx, end_idx);
+    int64_t batch[SWISS_BATCH];
+
+    for (int64_t i = span.first_i; i <= span.last_i; i++) {
+        int64_t j_first = covered_row_start(N, i, (i == span.first_i) ? span.first_j : i);
+        int64_t j_last = (i == span.last_i) ? span.last_j : N;
+        for (int64_t j = j_first; j <= j_last; j += SWISS_BATCH) {
+            int n = (j_last - j + 1 < SWISS_BATCH) ? (int)(j_last - j + 1) : SWISS_BATCH;
+            for (int k = 0; k < n; k++) {
+                batch[k] = i * (j + k);
+            }
+            swiss_insert_many(set, batch, n);
+        }
+    }
+}
+
+// Swiss set engine: the hash engine with the SwissSet in place of HashSet.
+// Returns M(N) on process 0 and 0 elsewhere.
+int64_t swiss_engine_count(const Options* opts, int world_rank, int world_size) {
+    // Presize for the expected unique count at the swiss load limit of 7/8
+    SwissSet unique_products;
+    swiss_init(&unique_products, estimate_local_distinct(opts, world_rank, world_size) / 7 * 8 + 1);
+
+    for_each_assigned_range(opts, world_rank, world_size, swiss_add_range, &unique_products);
+
+    // Signal completion of local computation
+    report_local_done(world_rank, world_size);
+
+    int64_t local_unique_count;
+    int64_t* local_unique_products = swiss_to_array(&unique_products, &local_unique_count);
+    swiss_free(&unique_products);
+    phase_lap(PHASE_TO_ARRAY);
+
+    return combine_local_products(local_unique_products, local_unique_count,
+                                  opts, world_rank, world_size);
+}
+
+// PairRangeFn: insert the products of the range into a ConcurrentHashSet
+// using every thread. The range is processed in rounds; before each round the
+// table reserves room for every pair in it, so threads never race with a resize.
+void concurrent_hashset_add_range(void* ctx, int64_t N, int64_t start_idx, int64_t end_idx) {
+    ConcurrentHashSet* set = (ConcurrentHashSet*)ctx;
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    int64_t round_pairs = HYBRID_TASK_PAIRS * threads * HYBRID_TASKS_PER_THREAD;
+
+    for (int64_t round_start = start_idx; round_start <= end_idx; round_start += round_pairs) {
+        int64_t round_end = round_start + round_pairs - 1;
+        if (round_end > end_idx) round_end = end_idx;
+        concurrent_hashset_reserve(set, round_end - round_start + 1);
+
+        int64_t tasks = (round_end - round_start + HYBRID_TASK_PAIRS) / HYBRID_TASK_PAIRS;
+        int64_t added = 0;
+
+        #pragma omp parallel for schedule(dynamic, 1) reduction(+:added)
+        for (int64_t t = 0; t < tasks; t++) {
+            int64_t task_start = round_start + t * HYBRID_TASK_PAIRS;
+            int64_t task_end = task_start + HYBRID_TASK_PAIRS - 1;
+            if (task_end > round_end) task_end = round_end;
+
+            PairSpan span = pair_span(N, task_start, task_end);
+            for (int64_t i = span.first_i; i <= span.last_i; i++) {
+                int64_t j_first = covered_row_start(N, i, (i == span.first_i) ? span.first_j : i);
+                int64_t j_last = (i == span.last_i) ? span.last_j : N;
+                for (int64_t j = j_first; j <= j_last; j++) {
+                    if (concurrent_hashset_add(set, i * j)) added++;
+                }
+            }
+        }
+
+        set->count += added;
+    }
+}
+
+// Hybrid MPI + threads engine: meant for one process per node (or NUMA
+// domain) with OMP_NUM_THREADS threads each. All threads of a process insert
+// into one shared lock-free set, so duplicates within the node are removed
+// before anything is sent, then the per-process sets are combined with the
+// selected dedup strategy. Returns M(N) on process 0 and 0 elsewhere.
+int64_t hybrid_engine_count(const Options* opts, int world_rank, int world_size) {
+    if (world_rank == 0) {
+#ifdef _OPENMP
+        printf("Using %d threads per process\n", omp_get_max_threads());
+#else
+        printf("Warning: built without OpenMP, the hybrid engine runs one thread per process\n");
+#endif
+        fflush(stdout);
+    }
+
+    // Presized from the same estimate as the hash engine, grows between rounds if needed
+    ConcurrentHashSet unique_products;
+    concurrent_hashset_init(&unique_products,
+        (int64_t)(estimate_local_distinct(opts, world_rank, world_size) / LOAD_FACTOR_THRESHOLD) + 1);
+
+    for_each_assigned_range(opts, world_rank, world_size,
+                            concurrent_hashset_add_range, &unique_products);
+
+    // Signal completion of local computation
+    report_local_done(world_rank, world_size);
+
+    int64_t local_unique_count;
+    int64_t* local_unique_products = concurrent_hashset_to_array(&unique_products, &local_unique_count);
+    concurrent_hashset_free(&unique_products);
+    phase_lap(PHASE_TO_ARRAY);
+
+    return combine_local_products(local_unique_products, local_unique_count,
+                                  opts, world_rank, world_size);
+}
+
+// Mark every product i*j (i <= j <= N) that falls in [lo, hi) in the window
+// bitmap and return how many distinct values the window holds
+int64_t bitmap_window_count(uint64_t* bits, int64_t lo, int64_t hi, int64_t N) {
+    int64_t words = (hi - lo + 63) / 64;
+    memset(bits, 0, words * sizeof(uint64_t));
+
+    // Rows below lo/N never reach the window and rows with i*i >= hi start past it
+    int64_t first_row = (lo + N - 1) / N;
+    if (first_row < 1) first_row = 1;
+
+    for (int64_t i = first_row; i <= N && i * i < hi; i++) {
+        // First and last j with i*j inside [lo, hi), clamped to i <= j <= N
+        int64_t j_lo = (lo + i - 1) / i;
+        int64_t j_hi = (hi - 1) / i;
+        if (j_lo < i) j_lo = i;
+        if (j_hi > N) j_hi = N;
+
+        for (int64_t offset = i * j_lo - lo; j_lo <= j_hi; j_lo++, offset += i) {
+            bits[offset >> 6] |= 1ULL << (offset & 63);
+        }
+    }
+
+    int64_t window_count = 0;
+    for (int64_t w = 0; w < words; w++) {
+        window_count += __builtin_popcountll(bits[w]);
+    }
+    return window_count;
+}
+
+// Receives one window [lo, hi) of product values to process
+typedef void (*WindowFn)(void* ctx, int64_t lo, int64_t hi);
+
+// Hand every BITMAP_WINDOW_BITS window of [1, max_value] assigned to this
+// process to fn: round-robin under the static schedule (low windows are the
+// densest), or claimed one at a time from the shared counter under the
+// dynamic one
+void for_each_assigned_window(const Options* opts, int64_t max_value,
+                              int world_rank, int world_size, WindowFn fn, void* ctx) {
+    int64_t window_count = (max_value + BITMAP_WINDOW_BITS - 1) / BITMAP_WINDOW_BITS;
+
+    if (opts->schedule == SCHED_DYNAMIC) {
+        WorkCounter counter;
+        work_counter_init(&counter, world_rank);
+
+        int64_t window;
+        while ((window = work_counter_next(&counter, 1)) < window_count) {
+            int64_t lo = 1 + window * BITMAP_WINDOW_BITS;
+            int64_t hi = lo + BITMAP_WINDOW_BITS;
+            if (hi > max_value + 1) hi = max_value + 1;
+            fn(ctx, lo, hi);
+        }
+
+        work_counter_free(&counter);
+    } else {
+        for (int64_t window = world_rank; window < window_count; window += world_size) {
+            int64_t lo = 1 + window * BITMAP_WINDOW_BITS;
+            int64_t hi = lo + BITMAP_WINDOW_BITS;
+            if (hi > max_value + 1) hi = max_value + 1;
+            fn(ctx, lo, hi);
+        }
+    }
+}
+
+// Window bitmap shared by the bitmap engines, plus what they accumulate
+typedef struct {
+    uint64_t* bits;
+    int64_t N;
+    int64_t unique_count;   // bitmap engine: distinct values seen
+    int64_t* new_per_row;   // sweep: new_per_row[n] = values first seen in row n
+} WindowState;
+
+// WindowFn: count the distinct products of one window
+void bitmap_count_window(void* ctx, int64_t lo, int64_t hi) {
+    WindowState* state = (WindowState*)ctx;
+    state->unique_count += bitmap_window_count(state->bits, lo, hi, state->N);
+}
+
+// Segmented bitmap sieve engine: split [1, N*N] into fixed windows of
+// BITMAP_WINDOW_BITS values and count each window with a cache-resident
+// bitmap. Windows are disjoint, so summing the per-window counts gives M(N)
+// with no merge step. Returns M(N) on process 0 and 0 elsewhere.
+int64_t bitmap_engine_count(const Options* opts, int world_rank, int world_size) {
+    WindowState state;
+    state.bits = (uint64_t*)malloc((BITMAP_WINDOW_BITS / 64) * sizeof(uint64_t));
+    state.N = opts->N;
+    state.unique_count = 0;
+    state.new_per_row = NULL;
+
+    for_each_assigned_window(opts, opts->N * opts->N, world_rank, world_size,
+                             bitmap_count_window, &state);
+    free(state.bits);
+
+    // Signal completion of local computation
+    report_local_done(world_rank, world_size);
+
+    int64_t global_unique_count = 0;
+    MPI_Reduce(&state.unique_count, &global_unique_count, 1, MPI_LONG_LONG,
+               MPI_SUM, 0, MPI_COMM_WORLD);
+    return global_unique_count;
+}
+
+// WindowFn for the sweep: walk rows n = 1, 2, ... in order and mark each
+// product n*j (j <= n) of the window, crediting every value to the first row
+// that produces it. That row is the smallest table containing the value, so
+// M(k) is the sum of new_per_row[1..k].
+void sweep_window(void* ctx, int64_t lo, int64_t hi) {
+    WindowState* state = (WindowState*)ctx;
+    uint64_t* bits = state->bits;
+    memset(bits, 0, ((hi - lo + 63) / 64) * sizeof(uint64_t));
+
+    // Row n only reaches the window once n*n >= lo, and stops at n*1 >= hi
+    int64_t first_row = isqrt64(lo - 1) + 1;
+    int64_t last_row = (hi - 1 < state->N) ? hi - 1 : state->N;
+
+    for (int64_t n = first_row; n <= last_row; n++) {
+        int64_t j_lo = (lo + n - 1) / n;
+        int64_t j_hi = (hi - 1) / n;
+        if (j_hi > n) j_hi = n;
+
+        int64_t row_new = 0;
+        for (int64_t offset = n * j_lo - lo; j_lo <= j_hi; j_lo++, offset += n) {
+            uint64_t bit = 1ULL << (offset & 63);
+            if (!(bits[offset >> 6] & bit)) {
+                bits[offset >> 6] |= bit;
+                row_new++;
+            }
+        }
+        state->new_per_row[n] += row_new;
+    }
+}
+
+// Sweep mode: M(k) for every k up to N in a single pass over the bitmap
+// windows. Process 0 writes M(k) for every multiple of the sweep step (and
+// for N) to Results/sweep_n<N>.csv. Returns M(N) on process 0 and 0 elsewhere.
+int64_t sweep_engine_count(const Options* opts, int world_rank, int world_size) {
+    int64_t N = opts->N;
+
+    WindowState state;
+    state.bits = (uint64_t*)malloc((BITMAP_WINDOW_BITS / 64) * sizeof(uint64_t));
+    state.N = N;
+    state.unique_count = 0;
+    state.new_per_row = (int64_t*)calloc(N + 1, sizeof(int64_t));
+
+    for_each_assigned_window(opts, N * N, world_rank, world_size, sweep_window, &state);
+    free(state.bits);
+
+    // Signal completion of local computation
+    report_local_done(world_rank, world_size);
+
+    int64_t* new_per_row = NULL;
+    if (world_rank == 0) {
+        new_per_row = (int64_t*)calloc(N + 1, sizeof(int64_t));
+    }
+    for (int64_t offset = 0; offset <= N; offset += INT_MAX) {
+        int count = (N + 1 - offset < INT_MAX) ? (int)(N + 1 - offset) : INT_MAX;
+        MPI_Reduce(state.new_per_row + offset, world_rank == 0 ? new_per_row + offset : NULL,
+                   count, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    }
+    free(state.new_per_row);
+
+    int64_t global_unique_count = 0;
+    if (world_rank == 0) {
+        char path[256];
+        snprintf(path, sizeof(path), "Results/sweep_n%" PRId64 ".csv", N);
+        FILE* csv = fopen(path, "w");
+        if (csv == NULL) {
+            printf("Warning: cannot write %s, sweep results are not saved\n", path);
+        } else {
+            fprintf(csv, "N,unique,total_products,percent_unique\n");
+        }
+
+        for (int64_t k = 1; k <= N; k++) {
+            global_unique_count += new_per_row[k];
+            if (csv != NULL && (k % opts->sweep_step == 0 || k == N)) {
+                fprintf(csv, "%" PRId64 ",%" PRId64 ",%" PRId64 ",%.4f\n", k, global_unique_count,
+                        k * k, (double)global_unique_count / ((double)k * (double)k) * 100.0);
+            }
+        }
+
+        if (csv != NULL) {
+            fclose(csv);
+            printf("Wrote M(k) for k up to %" PRId64 " to %s\n", N, path);
+        }
+        fflush(stdout);
+        free(new_per_row);
+    }
+    return global_unique_count;
+}
+
+// Node-shared bitmap engine. The processes of a node (grouped with
+// MPI_Comm_split_type) share one bitmap, allocated once per node with
+// MPI_Win_allocate_shared, and set its bits with atomic OR. The bitmap covers
+// a segment of at most --memory-mb of values; the segments of (N, N*N] are
+// dealt round-robin to the nodes, so a value is only ever counted on one node
+// and the node counts just add up. Row 1 holds every value up to N, so it is
+// skipped and N is added back on process 0.
+
+// Mark the products in the segment [lo, hi) that belong to this process's
+// rows. Rows are dealt round-robin to the processes of the node.
+void shared_mark_segment(uint64_t* bits, int64_t lo, int64_t hi, int64_t N,
+                         int node_rank, int node_size) {
+    // Rows below lo/N never reach the segment and rows with i*i >= hi start past it
+    int64_t first_row = (lo + N - 1) / N;
+    if (first_row < 2) first_row = 2;
+    int64_t last_row = isqrt64(hi - 1);
+    if (last_row > N) last_row = N;
+
+    for (int64_t i = first_row + node_rank; i <= last_row; i += node_size) {
+        int64_t j_lo = covered_row_start(N, i, (lo + i - 1) / i);
+        int64_t j_hi = (hi - 1) / i;
+        if (j_lo < i) j_lo = i;
+        if (j_hi > N) j_hi = N;
+
+        for (int64_t offset = i * j_lo - lo; j_lo <= j_hi; j_lo++, offset += i) {
+            uint64_t* word = &bits[offset >> 6];
+            uint64_t bit = 1ULL << (offset & 63);
+            // Most products are repeats, and a plain load skips their locked OR
+            if (!(__atomic_load_n(word, __ATOMIC_RELAXED) & bit)) {
+                __atomic_fetch_or(word, bit, __ATOMIC_RELAXED);
+            }
+        }
+    }
+}
+
+// Make every process's stores to the shared window visible to the others
+void shared_barrier(MPI_Win win, MPI_Comm node_comm) {
+    MPI_Win_sync(win);
+    MPI_Barrier(node_comm);
+    MPI_Win_sync(win);
+}
+
+// Returns M(N) on process 0 and 0 elsewhere
+int64_t shared_engine_count(const Options* opts, int world_rank, int world_size) {
+    int64_t N = opts->N;
+    int64_t max_value = N * N;
+
+    MPI_Comm node_comm;
+    int node_rank, node_size;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, world_rank, MPI_INFO_NULL,
+                        &node_comm);
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_size(node_comm, &node_size);
+
+    // Nodes are numbered by the ranks of their first processes
+    int node_id = 0;
+    int node_count = 0;
+    MPI_Comm leader_comm;
+    MPI_Comm_split(MPI_COMM_WORLD, node_rank == 0 ? 0 : MPI_UNDEFINED, world_rank, &leader_comm);
+    if (node_rank == 0) {
+        MPI_Comm_rank(leader_comm, &node_id);
+        MPI_Comm_size(leader_comm, &node_count);
+        MPI_Comm_free(&leader_comm);
+    }
+    MPI_Bcast(&node_id, 1, MPI_INT, 0, node_comm);
+    MPI_Bcast(&node_count, 1, MPI_INT, 0, node_comm);
+
+    // (N, N*N] is split into at least one segment per node so every node has
+    // work, and segments are made smaller still when one would exceed the
+    // budget
+    int64_t span = max_value - N;
+    int64_t segment_bits = (span + node_count - 1) / node_count;
+    segment_bits = (segment_bits + 63) / 64 * 64;
+    int64_t budget_bits = opts->memory_mb * 8 * ((int64_t)1 << 20);
+    if (segment_bits > budget_bits) segment_bits = budget_bits / 64 * 64;
+    if (segment_bits == 0) segment_bits = 64;
+    int64_t words = segment_bits / 64;
+
+    // The first process of the node allocates the bitmap, the others map it
+    uint64_t* bits;
+    MPI_Win win;
+    MPI_Aint bytes = (node_rank == 0) ? (MPI_Aint)(words * sizeof(uint64_t)) : 0;
+    MPI_Win_allocate_shared(bytes, sizeof(uint64_t), MPI_INFO_NULL, node_comm, &bits, &win);
+    if (node_rank != 0) {
+        MPI_Aint size;
+        int disp_unit;
+        MPI_Win_shared_query(win, 0, &size, &disp_unit, &bits);
+    }
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+
+    // Each process clears and popcounts its own slice of the words
+    int64_t word_lo = words * node_rank / node_size;
+    int64_t word_hi = words * (node_rank + 1) / node_size;
+
+    int64_t local_unique_count = 0;
+    int64_t segment_count = (span + segment_bits - 1) / segment_bits;
+    for (int64_t segment = node_id; segment < segment_count; segment += node_count) {
+        int64_t lo = N + 1 + segment * segment_bits;
+        int64_t hi = lo + segment_bits;
+        if (hi > max_value + 1) hi = max_value + 1;
+
+        memset(bits + word_lo, 0, (word_hi - word_lo) * sizeof(uint64_t));
+        shared_barrier(win, node_comm);
+        shared_mark_segment(bits, lo, hi, N, node_rank, node_size);
+        shared_barrier(win, node_comm);
+
+        for (int64_t w = word_lo; w < word_hi; w++) {
+            local_unique_count += __builtin_popcountll(bits[w]);
+        }
+    }
+
+    MPI_Win_unlock_all(win);
+    MPI_Win_free(&win);
+    MPI_Comm_free(&node_comm);
+
+    // Signal completion of local computation
+    report_local_done(world_rank, world_size);
+
+    if (world_rank == 0) local_unique_count += N;
+    int64_t global_unique_count = 0;
+    MPI_Reduce(&local_unique_count, &global_unique_count, 1, MPI_LONG_LONG,
+               MPI_SUM, 0, MPI_COMM_WORLD);
+    return global_unique_count;
+}
+
+// Divisor-test engine. Nothing is materialised: with j <= n, the product
+// n*j already appears in the (n-1)-table exactly when it has a divisor d with
+// n*j / (n-1) <= d <= n-1 (then n*j = d * (n*j/d) with both factors below n).
+// Each process counts the products that are new in their row, which sum to
+// M(N); it needs only a smallest-prime-factor sieve up to N and a
+// factorisation per product.
+//
+// Work is split with the same pair ranges as the hash engine. Triangle row i
+// has N-i+1 pairs, so it is read as table row n = N+1-i, whose n pairs are
+// the products n*1 .. n*n.
+
+// Distinct primes of a product of two numbers <= N with their exponents
+typedef struct {
+    int64_t prime[DIVISOR_MAX_PRIMES];
+    int exponent[DIVISOR_MAX_PRIMES];
+    int count;
+} Factorization;
+
+// Smallest prime factor of every k <= limit, with spf[1] = 1
+int32_t* smallest_prime_factors(int64_t limit) {
+    int32_t* spf = (int32_t*)calloc(limit + 1, sizeof(int32_t));
+    spf[1] = 1;
+    for (int64_t p = 2; p <= limit; p++) {
+        if (spf[p] != 0) continue;
+        for (int64_t k = p; k <= limit; k += p) {
+            if (spf[k] == 0) spf[k] = (int32_t)p;
+        }
+    }
+    return spf;
+}
+
+// Multiply the factorization by k <= limit of the sieve
+void factorization_multiply(Factorization* f, int64_t k, const int32_t* spf) {
+    while (k > 1) {
+        int64_t p = spf[k];
+        int e = 0;
+        while (k % p == 0) {
+            k /= p;
+            e++;
+        }
+
+        int slot = 0;
+        while (slot < f->count && f->prime[slot] != p) slot++;
+        if (slot == f->count) {
+            f->prime[slot] = p;
+            f->exponent[slot] = 0;
+            f->count++;
+        }
+        f->exponent[slot] += e;
+    }
+}
+
+// True if some divisor d * (product of remaining prime powers) lies in [lo, hi].
+// Partial divisors above hi are pruned, since they only grow.
+bool has_divisor_between(const Factorization* f, int index, int64_t d, int64_t lo, int64_t hi) {
+    if (index == f->count) return d >= lo;
+
+    int64_t p = f->prime[index];
+    for (int e = 0; e <= f->exponent[index]; e++) {
+        if (has_divisor_between(f, index + 1, d, lo, hi)) return true;
+        if (d > hi / p) break;
+        d *= p;
+    }
+    return false;
+}
+
+// Divisor engine state for one process
+typedef struct {
+    const int32_t* spf;
+    int64_t new_count;
+} DivisorState;
+
+// PairRangeFn: count the products of the range that are new in their table row
+void divisor_count_range(void* ctx, int64_t N, int64_t start_idx, int64_t end_idx) {
+    DivisorState* state = (DivisorState*)ctx;
+    PairSpan span = pair_span(N, start_idx, end_idx);
+
+    for (int64_t i = span.first_i; i <= span.last_i; i++) {
+        int64_t n = N + 1 - i;
+        int64_t j_first = ((i == span.first_i) ? span.first_j : i) - i + 1;
+        int64_t j_last = ((i == span.last_i) ? span.last_j : N) - i + 1;
+
+        Factorization row;
+        row.count = 0;
+        factorization_multiply(&row, n, state->spf);
+
+        for (int64_t j = j_first; j <= j_last; j++) {
+            // n*n (and everything in row 1) is always new
+            if (j == n || n == 1) {
+                state->new_count++;
+                continue;
+            }
+
+            int64_t v = n * j;
+            Factorization f = row;
+            factorization_multiply(&f, j, state->spf);
+            if (!has_divisor_between(&f, 0, 1, (v + n - 2) / (n - 1), n - 1)) {
+                state->new_count++;
+            }
+        }
+    }
+}
+
+// Divisor-test engine: count M(N) without a hash set, sort or gather.
+// Returns M(N) on process 0 and 0 elsewhere.
+int64_t divisor_engine_count(const Options* opts, int world_rank, int world_size) {
+    DivisorState state;
+    int32_t* spf = smallest_prime_factors(opts->N);
+    state.spf = spf;
+    state.new_count = 0;
+
+    for_each_assigned_range(opts, world_rank, world_size, divisor_count_range, &state);
+    free(spf);
+
+    // Signal completion of local computation
+    report_local_done(world_rank, world_size);
+
+    int64_t global_unique_count = 0;
+    MPI_Reduce(&state.new_count, &global_unique_count, 1, MPI_LONG_LONG,
+               MPI_SUM, 0, MPI_COMM_WORLD);
+    return global_unique_count;
+}
+
+// Approximate mode: each process feeds its products into a HyperLogLog
+// sketch of 2^p one-byte registers. Register r keeps the longest run of
+// leading zeros (plus one) seen among hashes whose top p bits are r, so the
+// sketches of all processes merge with an element-wise max.
+typedef struct {
+    uint8_t* registers;
+    int precision;
+} HyperLogLog;
+
+// PairRangeFn: add every product of the range to the sketch
+void hll_add_range(void* ctx, int64_t N, int64_t start_idx, int64_t end_idx) {
+    HyperLogLog* hll = (HyperLogLog*)ctx;
+    int p = hll->precision;
+    PairSpan span = pair_span(N, start_idx, end_idx);
+
+    for (int64_t i = span.first_i; i <= span.last_i; i++) {
+        int64_t j_first = covered_row_start(N, i, (i == span.first_i) ? span.first_j : i);
+        int64_t j_last = (i == span.last_i) ? span.last_j : N;
+        for (int64_t j = j_first; j <= j_last; j++) {
+            uint64_t h = swiss_hash(i * j);
+            // The sentinel bit caps the rank at 64 - p + 1 when the rest is zero
+            uint64_t rest = (h << p) | ((uint64_t)1 << (p - 1));
+            uint8_t rank = (uint8_t)(__builtin_clzll(rest) + 1);
+            uint8_t* reg = &hll->registers[h >> (64 - p)];
+            if (rank > *reg) *reg = rank;
+        }
+    }
+}
+
+// MPI_User_function: merge sketches by taking the larger of each register
+void hll_merge_op(void* in, void* inout, int* len, MPI_Datatype* datatype) {
+    (void)datatype;
+    const uint8_t* a = (const uint8_t*)in;
+    uint8_t* b = (uint8_t*)inout;
+    for (int r = 0; r < *len; r++) {
+        if (a[r] > b[r]) b[r] = a[r];
+    }
+}
+
+// Standard HyperLogLog estimate, with linear counting while registers are
+// still empty (small cardinalities). 64-bit hashes need no large-range fix.
+double hll_estimate(const uint8_t* registers, int precision) {
+    int64_t m = (int64_t)1 << precision;
+    double sum = 0.0;
+    int64_t zeros = 0;
+    for (int64_t r = 0; r < m; r++) {
+        sum += ldexp(1.0, -registers[r]);
+        if (registers[r] == 0) zeros++;
+    }
+
+    double alpha = 0.7213 / (1.0 + 1.079 / (double)m);
+    double estimate = alpha * (double)m * (double)m / sum;
+    if (estimate <= 2.5 * (double)m && zeros > 0) {
+        estimate = (double)m * log((double)m / (double)zeros);
+    }
+    return estimate;
+}
+
+// Relative standard error of a HyperLogLog sketch with 2^precision registers
+double hll_relative_error(int precision) {
+    return 1.04 / sqrt(ldexp(1.0, precision));
+}
+
+// Approximate engine: sketch this process's products, merge the sketches on
+// process 0 with a custom reduction and estimate M(N) from the result.
+// Returns the rounded estimate on process 0 and 0 elsewhere.
+int64_t approx_engine_count(const Options* opts, int world_rank, int world_size) {
+    int m = 1 << opts->approx_bits;
+    HyperLogLog hll;
+    hll.precision = opts->approx_bits;
+    hll.registers = (uint8_t*)calloc(m, sizeof(uint8_t));
+
+    for_each_assigned_range(opts, world_rank, world_size, hll_add_range, &hll);
+
+    // Signal completion of local computation
+    report_local_done(world_rank, world_size);
+
+    MPI_Op merge_op;
+    MPI_Op_create(hll_merge_op, 1, &merge_op);
+    uint8_t* merged = (world_rank == 0) ? (uint8_t*)malloc(m) : NULL;
+    MPI_Reduce(hll.registers, merged, m, MPI_UNSIGNED_CHAR, merge_op, 0, MPI_COMM_WORLD);
+    MPI_Op_free(&merge_op);
+    free(hll.registers);
+
+    int64_t global_unique_count = 0;
+    if (world_rank == 0) {
+        // The sketch saw only products above N; 1..N are added back exactly
+        global_unique_count = llround(hll_estimate(merged, opts->approx_bits)) + opts->N;
+        free(merged);
+    }
+    return global_unique_count;
+}
+
+// Gather every process's phase times on process 0 and append one CSV row per
+// process to opts->timings_file, writing the header first if the file is new
+void write_timings(const Options* opts, double total_seconds, int world_rank, int world_size) {
+    double local[PHASE_COUNT + 1];
+    memcpy(local, phase_seconds, sizeof(phase_seconds));
+    local[PHASE_COUNT] = total_seconds;
+
+    double* all = NULL;
+    if (world_rank == 0) {
+        all = (double*)malloc((size_t)world_size * (PHASE_COUNT + 1) * sizeof(double));
+    }
+    MPI_Gather(local, PHASE_COUNT + 1, MPI_DOUBLE, all, PHASE_COUNT + 1, MPI_DOUBLE,
+               0, MPI_COMM_WORLD);
+    if (world_rank != 0) return;
+
+    const char* mode = engine_names[opts->engine];
+    if (opts->approx_bits > 0) mode = "approx";
+    else if (opts->sweep_step > 0) mode = "sweep";
+
+    FILE* file = fopen(opts->timings_file, "a");
+    if (file == NULL) {
+        printf("Error: cannot open timings file '%s'\n", opts->timings_file);
+        fflush(stdout);
+        free(all);
+        return;
+    }
+
+    if (ftell(file) == 0) {
+        fprintf(file, "n,processes,engine,dedup,schedule,rank");
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            fprintf(file, ",%s", phase_names[p]);
+        }
+        fprintf(file, ",total\n");
+    }
+
+    for (int r = 0; r < world_size; r++) {
+        fprintf(file, "%" PRId64 ",%d,%s,%s,%s,%d", opts->N, world_size, mode,
+                dedup_names[opts->dedup],
+                opts->schedule == SCHED_DYNAMIC ? "dynamic" : "static", r);
+        for (int p = 0; p <= PHASE_COUNT; p++) {
+            fprintf(file, ",%.6f", all[r * (PHASE_COUNT + 1) + p]);
+        }
+        fprintf(file, "\n");
+    }
+
+    fclose(file);
+    free(all);
+}
+
+#ifdef HASH_STATS
+// Per-process fields of HashStats packed for MPI_Gather
+#define HASH_STATS_FIELDS (7 + HASH_STATS_BINS)
+
+// Write the gathered HashSet statistics as a table per process, a total row
+// and the probe-length histogram summed over all processes
+void print_hash_stats(FILE* out, int64_t N, const int64_t* all, const double* seconds,
+                      int world_size) {
+    fprintf(out, "HashSet statistics for M(%" PRId64 ") with %d processes "
+            "(LOAD_FACTOR_THRESHOLD %.2f, %d segments)\n",
+            N, world_size, LOAD_FACTOR_THRESHOLD, HASH_SEGMENTS);
+    fprintf(out, "%6s %14s %10s %10s %8s %10s %12s %10s\n", "rank", "lookups", "avg_probe",
+            "max_probe", "resizes", "resize_s", "load_factor", "peak_MB");
+
+    int64_t total[HASH_STATS_FIELDS] = {0};
+    double total_seconds = 0.0;
+    for (int r = 0; r <= world_size; r++) {
+        // Rows for each process, then a total row (max for max_probe)
+        const int64_t* f = (r < world_size) ? &all[r * HASH_STATS_FIELDS] : total;
+        double resize_seconds = (r < world_size) ? seconds[r] : total_seconds;
+        char label[16];
+        if (r < world_size) snprintf(label, sizeof(label), "%d", r);
+        else snprintf(label, sizeof(label), "all");
+
+        fprintf(out, "%6s %14" PRId64 " %10.3f %10" PRId64 " %8" PRId64 " %10.3f %12.3f %10.1f\n",
+                label, f[0], f[0] > 0 ? (double)f[1] / (double)f[0] : 0.0, f[2], f[3],
+                resize_seconds, f[6] > 0 ? (double)f[5] / (double)f[6] : 0.0,
+                (double)f[4] / (1024.0 * 1024.0));
+
+        if (r < world_size) {
+            for (int k = 0; k < HASH_STATS_FIELDS; k++) {
+                total[k] = (k == 2) ? (f[k] > total[k] ? f[k] : total[k]) : total[k] + f[k];
+            }
+            total_seconds += seconds[r];
+        }
+    }
+
+    fprintf(out, "Probe length histogram (all processes):\n");
+    for (int b = 0; b < HASH_STATS_BINS; b++) {
+        int64_t count = total[7 + b];
+        if (count == 0) continue;
+        fprintf(out, "%4d%s %14" PRId64 " %8.4f%%\n", b, b == HASH_STATS_BINS - 1 ? "+" : " ",
+                count, 100.0 * (double)count / (double)total[0]);
+    }
+}
+
+// Gather every process's HashSet statistics on process 0, print them and
+// write them to $HASH_STATS_FILE (default hash_stats_n<N>.txt)
+void report_hash_stats(int64_t N, int world_rank, int world_size) {
+    int64_t local[HASH_STATS_FIELDS] = {
+        hash_stats.lookups, hash_stats.probes, hash_stats.max_probe, hash_stats.resizes,
+        hash_stats.peak_bytes, hash_stats.final_count, hash_stats.final_size
+    };
+    memcpy(&local[7], hash_stats.histogram, sizeof(hash_stats.histogram));
+
+    int64_t* all = NULL;
+    double* seconds = NULL;
+    if (world_rank == 0) {
+        all = (int64_t*)malloc((size_t)world_size * HASH_STATS_FIELDS * sizeof(int64_t));
+        seconds = (double*)malloc(world_size * sizeof(double));
+    }
+    MPI_Gather(local, HASH_STATS_FIELDS, MPI_LONG_LONG, all, HASH_STATS_FIELDS, MPI_LONG_LONG,
+               0, MPI_COMM_WORLD);
+    MPI_Gather(&hash_stats.resize_seconds, 1, MPI_DOUBLE, seconds, 1, MPI_DOUBLE,
+               0, MPI_COMM_WORLD);
+    if (world_rank != 0) return;
+
+    print_hash_stats(stdout, N, all, seconds, world_size);
+
+    char path[4096];
+    const char* env_path = getenv("HASH_STATS_FILE");
+    if (env_path != NULL) {
+        snprintf(path, sizeof(path), "%s", env_path);
+    } else {
+        snprintf(path, sizeof(path), "hash_stats_n%" PRId64 ".txt", N);
+    }
+
+    FILE* file = fopen(path, "w");
+    if (file != NULL) {
+        print_hash_stats(file, N, all, seconds, world_size);
+        fclose(file);
+        printf("HashSet statistics written to %s\n", path);
+    } else {
+        printf("Error: cannot write HashSet statistics to '%s'\n", path);
+    }
+    fflush(stdout);
+
+    free(seconds);
+    free(all);
+}
+#endif
+
+// Count M(N) for opts->N with the selected engine, print the result on
+// process 0 and write the per-query outputs. start_time is when the clock
+// printed as "Time elapsed" started.
+void answer_query(const Options* opts, int world_rank, int world_size, double start_time) {
+    double query_start = MPI_Wtime();
+    memset(phase_seconds, 0, sizeof(phase_seconds));
+    phase_mark = query_start;
+#ifdef HASH_STATS
+    hash_stats_reset();
+#endif
+
+    char label[64];
+    table_label(opts, label, sizeof(label));
+    if (world_rank == 0) {
+        printf("Computing %s with %d processes...\n", label, world_size);
+        fflush(stdout);
+    }
+
+    int64_t global_unique_count;
+    if (opts->approx_bits > 0) {
+        global_unique_count = approx_engine_count(opts, world_rank, world_size);
+    } else if (opts->sweep_step > 0) {
+        global_unique_count = sweep_engine_count(opts, world_rank, world_size);
+    } else if (opts->engine == ENGINE_BITMAP) {
+        global_unique_count = bitmap_engine_count(opts, world_rank, world_size);
+    } else if (opts->engine == ENGINE_HYBRID) {
+        global_unique_count = hybrid_engine_count(opts, world_rank, world_size);
+    } else if (opts->engine == ENGINE_SWISS) {
+        global_unique_count = swiss_engine_count(opts, world_rank, world_size);
+    } else if (opts->engine == ENGINE_DIVISOR) {
+        global_unique_count = divisor_engine_count(opts, world_rank, world_size);
+    } else if (opts->engine == ENGINE_SHARED) {
+        global_unique_count = shared_engine_count(opts, world_rank, world_size);
+    } else if (opts->engine == ENGINE_MERGE) {
+        global_unique_count = table_fits_key32(opts) ? merge_engine_count32(opts, world_rank, world_size)
+                                                 : merge_engine_count(opts, world_rank, world_size);
+    } else {
+        global_unique_count = hash_engine_count(opts, world_rank, world_size);
+    }
+
+    // Whatever follows the last lap is the final reduction of the engine
+    phase_lap(PHASE_EXCHANGE);
+    if (opts->timings_file != NULL) {
+        write_timings(opts, MPI_Wtime() - query_start, world_rank, world_size);
+    }
+#ifdef HASH_STATS
+    report_hash_stats(opts->N, world_rank, world_size);
+#endif
+
+    if (world_rank == 0) {
+        double end_time = MPI_Wtime();
+
+        // Print results with total products for comparison
+        // Use format specifiers for int64_t
+        if (opts->approx_bits > 0) {
+            double error = hll_relative_error(opts->approx_bits);
+            printf("%s ~ %" PRId64 " (+/- %.2f%%, about %" PRId64
+                   " at one standard error)\n", label, global_unique_count, error * 100.0,
+                   (int64_t)llround(error * (double)global_unique_count));
+        } else {
+            printf("%s = %" PRId64 "\n", label, global_unique_count);
+        }
+        printf("Total products in table: %" PRId64 "\n", table_cells(opts));
+        printf("Percentage of unique products: %.2f%%\n",
+               (double)global_unique_count / (double)table_cells(opts) * 100.0);
+        printf("Time elapsed: %.6f seconds\n", end_time - start_time);
+        fflush(stdout);
+    }
+}
+
+// qsort order for the batch: largest N first
+int compare_descending(const void* a, const void* b) {
+    int64_t va = *(const int64_t*)a;
+    int64_t vb = *(const int64_t*)b;
+    return (va < vb) - (va > vb);
+}
+
+// Append the values of --batch-file to the batch on process 0, then share the
+// whole batch with every process, largest N first and without repeats.
+// Returns false (on every process) if the file cannot be read, holds
+// anything but positive integers, or a three-factor batch has an N too large
+// for 64-bit products.
+bool load_batch(Options* opts, int world_rank) {
+    int ok = 1;
+    if (world_rank == 0 && opts->batch_file != NULL) {
+        FILE* file = fopen(opts->batch_file, "r");
+        char* text = NULL;
+        if (file != NULL) {
+            fseek(file, 0, SEEK_END);
+            long size = ftell(file);
+            fseek(file, 0, SEEK_SET);
+            text = (char*)malloc(size > 0 ? size + 1 : 1);
+            size_t got = fread(text, 1, size > 0 ? (size_t)size : 0, file);
+            text[got] = '\0';
+            fclose(file);
+        }
+        if (text == NULL) {
+            printf("Error: cannot read batch file '%s'\n", opts->batch_file);
+            ok = 0;
+        } else if (!append_batch_values(opts, text) || opts->batch_count == 0) {
+            printf("Error: batch file '%s' must hold positive integers\n", opts->batch_file);
+            ok = 0;
+        }
+        fflush(stdout);
+        free(text);
+    }
+    MPI_Bcast(&ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (!ok) return false;
+
+    MPI_Bcast(&opts->batch_count, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    if (opts->batch_count == 0) return true;
+    if (world_rank != 0) {
+        opts->batch = (int64_t*)realloc(opts->batch, opts->batch_count * sizeof(int64_t));
+    }
+    check_mpi_count(opts->batch_count, "Batch broadcast");
+    MPI_Bcast(opts->batch, (int)opts->batch_count, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+
+    qsort(opts->batch, opts->batch_count, sizeof(int64_t), compare_descending);
+    if (opts->factors == 3 && opts->batch[0] > FACTORS3_MAX_N) {
+        if (world_rank == 0) {
+            printf("Error: --factors=3 supports N up to %d\n", FACTORS3_MAX_N);
+            fflush(stdout);
+        }
+        return false;
+    }
+    int64_t kept = 0;
+    for (int64_t q = 0; q < opts->batch_count; q++) {
+        if (kept == 0 || opts->batch[q] != opts->batch[kept - 1]) {
+            opts->batch[kept++] = opts->batch[q];
+        }
+    }
+    opts->batch_count = kept;
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    MPI_Init(&argc, &argv);
+    int world_size, world_rank;
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    double start_time = MPI_Wtime();
+
+    // Get N and options from the command line, N defaults to 10 for safety
+    Options opts;
+    if (!parse_options(argc, argv, &opts, world_rank) || !load_batch(&opts, world_rank)) {
+        MPI_Finalize();
+        return 1;
+    }
+
+    if (opts.batch_count == 0) {
+        // Broadcast N to all processes
+        MPI_Bcast(&opts.N, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+        answer_query(&opts, world_rank, world_size, start_time);
+    } else {
+        // One job answers every N, so the processes and the hash sets they
+        // keep between queries are set up once
+        for (int64_t q = 0; q < opts.batch_count; q++) {
+            opts.N = opts.batch[q];
+            answer_query(&opts, world_rank, world_size, MPI_Wtime());
+        }
+        hashset_free(&batch_set);
+        hashset_free32(&batch_set32);
+
+        if (world_rank == 0) {
+            printf("Answered %" PRId64 " values of N in %.6f seconds\n",
+                   opts.batch_count, MPI_Wtime() - start_time);
+            fflush(stdout);
+        }
+    }
+
+    free(opts.batch);
+    MPI_Finalize();
+    return 0;
+}
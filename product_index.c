@@ -0,0 +1,115 @@
+// Query an index written by multiplication_opt_64bit --index=FILE:
+//
+//   product_index FILE info
+//   product_index FILE contains V [V ...]
+//   product_index FILE rank X [X ...]        distinct products <= X
+//   product_index FILE range LO HI [--list]  distinct products in [LO, HI]
+//
+// The file is memory-mapped, so each query reads only the blocks it needs.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include "product_index.h"
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: product_index FILE info\n"
+            "       product_index FILE contains V [V ...]\n"
+            "       product_index FILE rank X [X ...]\n"
+            "       product_index FILE range LO HI [--list]\n");
+}
+
+// Parse a non-negative decimal value that fits uint64_t. Returns false for
+// anything else, including a sign, trailing characters or overflow.
+static bool parse_value(const char* text, uint64_t* value) {
+    if (*text < '0' || *text > '9') return false;
+
+    char* end;
+    errno = 0;
+    unsigned long long parsed = strtoull(text, &end, 10);
+    if (*end != '\0' || errno == ERANGE) return false;
+
+    *value = (uint64_t)parsed;
+    return true;
+}
+
+// Parse argv[first..argc-1] as values, or print the usage and return false
+static bool parse_values(int argc, char *argv[], int first, uint64_t* values) {
+    for (int a = first; a < argc; a++) {
+        if (!parse_value(argv[a], &values[a - first])) {
+            fprintf(stderr, "Error: '%s' is not an unsigned 64-bit integer\n", argv[a]);
+            usage();
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        usage();
+        return 1;
+    }
+
+    ProductIndex index;
+    if (!product_index_open(&index, argv[1])) {
+        fprintf(stderr, "Error: %s is not a readable product index\n", argv[1]);
+        return 1;
+    }
+
+    const char* command = argv[2];
+    uint64_t* values = (uint64_t*)malloc(argc * sizeof(uint64_t));
+    int status = 0;
+    if (strcmp(command, "info") == 0) {
+        const ProductIndexHeader* h = index.header;
+        printf("N: %" PRIu64 "\n", h->n);
+        printf("Distinct products: %" PRIu64 "\n", h->count);
+        printf("Blocks: %" PRIu64 " of %" PRIu64 " values\n", h->block_count, h->block_values);
+        printf("File size: %zu bytes (%.2f bytes per product)\n", index.size,
+               h->count > 0 ? (double)index.size / (double)h->count : 0.0);
+    } else if (strcmp(command, "contains") == 0 && argc > 3) {
+        if (!parse_values(argc, argv, 3, values)) {
+            status = 1;
+        } else {
+            for (int a = 3; a < argc; a++) {
+                uint64_t v = values[a - 3];
+                printf("%" PRIu64 " %s\n", v, product_index_contains(&index, v) ? "yes" : "no");
+            }
+        }
+    } else if (strcmp(command, "rank") == 0 && argc > 3) {
+        if (!parse_values(argc, argv, 3, values)) {
+            status = 1;
+        } else {
+            for (int a = 3; a < argc; a++) {
+                uint64_t x = values[a - 3];
+                printf("%" PRIu64 " %" PRIu64 "\n", x, product_index_rank(&index, x));
+            }
+        }
+    } else if (strcmp(command, "range") == 0 && (argc == 5 || argc == 6)) {
+        if (argc == 6 && strcmp(argv[5], "--list") != 0) {
+            usage();
+            status = 1;
+        } else if (!parse_values(5, argv, 3, values)) {
+            status = 1;
+        } else if (argc == 6) {
+            uint64_t lo = values[0], hi = values[1];
+            ProductIndexCursor cursor;
+            bool more = product_index_seek(&index, &cursor, lo);
+            while (more && cursor.value <= hi) {
+                printf("%" PRIu64 "\n", cursor.value);
+                more = product_index_next(&cursor);
+            }
+        } else {
+            printf("%" PRIu64 "\n", product_index_range_count(&index, values[0], values[1]));
+        }
+    } else {
+        usage();
+        status = 1;
+    }
+
+    free(values);
+    product_index_close(&index);
+    return status;
+}
@@ -0,0 +1,270 @@
+// Persisted index of the distinct products of an N-table. The file answers
+// "is v in the table?", "how many distinct products are <= x?" and range
+// queries through mmap, reading one sparse index entry per block plus at most
+// one block, so nothing is loaded up front. The writer is used by
+// multiplication_opt_64bit --index=FILE and the reader by product_index.c.
+// The header needs no MPI; the mmap reader is POSIX only and is left out of
+// Windows builds.
+//
+// File layout, every integer a uint64_t in host byte order:
+//   header  magic "MTINDEX1", N, count, block_values, block_count,
+//           data_offset, index_offset
+//   data    per block, the varint gaps between its values after the first
+//   index   per block, its first value and the offset of its gaps from
+//           data_offset
+// Block b holds the values of rank b*block_values onwards, so the rank of a
+// value is its block's base rank plus its position in the block.
+#ifndef PRODUCT_INDEX_H
+#define PRODUCT_INDEX_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Values per block: a query decodes at most this many gaps
+#define PRODUCT_INDEX_BLOCK_VALUES 128
+#define PRODUCT_INDEX_MAGIC "MTINDEX1"
+
+typedef struct {
+    char magic[8];
+    uint64_t n;
+    uint64_t count;          // distinct products, M(N)
+    uint64_t block_values;
+    uint64_t block_count;
+    uint64_t data_offset;    // file offset of the first block's gaps
+    uint64_t index_offset;   // file offset of the sparse index, 8-byte aligned
+} ProductIndexHeader;
+
+typedef struct {
+    uint64_t first_value;
+    uint64_t offset;         // of the block's gaps, from data_offset
+} ProductIndexEntry;
+
+// Streaming writer: values are added in increasing order, the sparse index is
+// kept in memory (16 bytes per block) and written after the data on close
+typedef struct {
+    FILE* file;
+    ProductIndexHeader header;
+    ProductIndexEntry* entries;
+    uint64_t entry_capacity;
+    uint64_t data_size;      // gap bytes written so far
+    uint64_t last;           // last value added
+} ProductIndexWriter;
+
+// Create path and write a placeholder header. Returns false if the file
+// cannot be created.
+static inline bool product_index_writer_open(ProductIndexWriter* writer, const char* path, uint64_t n) {
+    memset(writer, 0, sizeof(*writer));
+    writer->file = fopen(path, "wb");
+    if (writer->file == NULL) return false;
+
+    memcpy(writer->header.magic, PRODUCT_INDEX_MAGIC, 8);
+    writer->header.n = n;
+    writer->header.block_values = PRODUCT_INDEX_BLOCK_VALUES;
+    writer->header.data_offset = sizeof(ProductIndexHeader);
+    return fwrite(&writer->header, sizeof(ProductIndexHeader), 1, writer->file) == 1;
+}
+
+// Append a value larger than every value added before it
+static inline void product_index_writer_add(ProductIndexWriter* writer, uint64_t value) {
+    if (writer->header.count % PRODUCT_INDEX_BLOCK_VALUES == 0) {
+        if (writer->header.block_count == writer->entry_capacity) {
+            writer->entry_capacity = writer->entry_capacity * 2 + 64;
+            writer->entries = (ProductIndexEntry*)realloc(
+                writer->entries, writer->entry_capacity * sizeof(ProductIndexEntry));
+        }
+        ProductIndexEntry* entry = &writer->entries[writer->header.block_count++];
+        entry->first_value = value;
+        entry->offset = writer->data_size;
+    } else {
+        uint64_t gap = value - writer->last;
+        while (gap >= 0x80) {
+            putc((int)((gap & 0x7f) | 0x80), writer->file);
+            gap >>= 7;
+            writer->data_size++;
+        }
+        putc((int)gap, writer->file);
+        writer->data_size++;
+    }
+    writer->last = value;
+    writer->header.count++;
+}
+
+// Write the sparse index and the final header, then close the file.
+// Returns false if any write failed.
+static inline bool product_index_writer_close(ProductIndexWriter* writer) {
+    // Pad the data so the index can be read in place as uint64_t pairs
+    uint64_t end = writer->header.data_offset + writer->data_size;
+    for (; end % 8 != 0; end++) putc(0, writer->file);
+    writer->header.index_offset = end;
+
+    bool ok = fwrite(writer->entries, sizeof(ProductIndexEntry), writer->header.block_count,
+                     writer->file) == writer->header.block_count;
+    ok = ok && fseek(writer->file, 0, SEEK_SET) == 0;
+    ok = ok && fwrite(&writer->header, sizeof(ProductIndexHeader), 1, writer->file) == 1;
+    ok = !ferror(writer->file) && ok;
+    ok = (fclose(writer->file) == 0) && ok;
+
+    free(writer->entries);
+    writer->entries = NULL;
+    writer->file = NULL;
+    return ok;
+}
+
+#ifndef _WIN32
+// Read-only view of an index file mapped into memory
+typedef struct {
+    const uint8_t* base;
+    size_t size;
+    const ProductIndexHeader* header;
+    const ProductIndexEntry* entries;
+    const uint8_t* data;
+} ProductIndex;
+
+// Map an index file and check its header. Returns false if the file is
+// missing or is not a complete index.
+static inline bool product_index_open(ProductIndex* index, const char* path) {
+    memset(index, 0, sizeof(*index));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ProductIndexHeader)) {
+        close(fd);
+        return false;
+    }
+    void* base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return false;
+
+    index->base = (const uint8_t*)base;
+    index->size = (size_t)st.st_size;
+    index->header = (const ProductIndexHeader*)base;
+
+    const ProductIndexHeader* h = index->header;
+    bool valid = memcmp(h->magic, PRODUCT_INDEX_MAGIC, 8) == 0
+        && h->block_values > 0
+        && h->block_count == (h->count + h->block_values - 1) / h->block_values
+        && h->data_offset <= h->index_offset && h->index_offset % 8 == 0
+        && h->index_offset + h->block_count * sizeof(ProductIndexEntry) <= index->size;
+    if (!valid) {
+        munmap(base, index->size);
+        memset(index, 0, sizeof(*index));
+        return false;
+    }
+
+    index->entries = (const ProductIndexEntry*)(index->base + h->index_offset);
+    index->data = index->base + h->data_offset;
+    return true;
+}
+
+// Unmap an index opened with product_index_open
+static inline void product_index_close(ProductIndex* index) {
+    if (index->base != NULL) munmap((void*)index->base, index->size);
+    memset(index, 0, sizeof(*index));
+}
+
+// Read one varint gap and advance *pos past it
+static inline uint64_t product_index_gap(const uint8_t** pos) {
+    uint64_t v = 0;
+    int shift = 0;
+    uint8_t b;
+    do {
+        b = *(*pos)++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return v;
+}
+
+// Last block whose first value is <= x, or -1 if x is below every value
+static inline int64_t product_index_block(const ProductIndex* index, uint64_t x) {
+    int64_t lo = 0, hi = (int64_t)index->header->block_count - 1, found = -1;
+    while (lo <= hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (index->entries[mid].first_value <= x) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return found;
+}
+
+// Position in the index: the value of rank `rank` (0-based) and where the
+// gap of the next value in its block starts
+typedef struct {
+    const ProductIndex* index;
+    uint64_t rank;
+    uint64_t value;
+    const uint8_t* pos;
+} ProductIndexCursor;
+
+// Place the cursor on the first value of block b
+static inline void product_index_cursor_block(ProductIndexCursor* cursor, const ProductIndex* index,
+                                       int64_t b) {
+    cursor->index = index;
+    cursor->rank = (uint64_t)b * index->header->block_values;
+    cursor->value = index->entries[b].first_value;
+    cursor->pos = index->data + index->entries[b].offset;
+}
+
+// Advance to the next value, returns false past the last one
+static inline bool product_index_next(ProductIndexCursor* cursor) {
+    const ProductIndexHeader* h = cursor->index->header;
+    if (cursor->rank + 1 >= h->count) {
+        cursor->rank = h->count;
+        return false;
+    }
+    cursor->rank++;
+    if (cursor->rank % h->block_values == 0) {
+        product_index_cursor_block(cursor, cursor->index, (int64_t)(cursor->rank / h->block_values));
+    } else {
+        cursor->value += product_index_gap(&cursor->pos);
+    }
+    return true;
+}
+
+// Place the cursor on the first value >= x, returns false if there is none
+static inline bool product_index_seek(const ProductIndex* index, ProductIndexCursor* cursor, uint64_t x) {
+    if (index->header->count == 0) return false;
+    int64_t b = product_index_block(index, x);
+    product_index_cursor_block(cursor, index, b < 0 ? 0 : b);
+    while (cursor->value < x) {
+        if (!product_index_next(cursor)) return false;
+    }
+    return true;
+}
+
+// Number of distinct products <= x
+static inline uint64_t product_index_rank(const ProductIndex* index, uint64_t x) {
+    ProductIndexCursor cursor;
+    if (x == UINT64_MAX || !product_index_seek(index, &cursor, x + 1)) {
+        return index->header->count;
+    }
+    return cursor.rank;
+}
+
+// Whether v is a product of the table
+static inline bool product_index_contains(const ProductIndex* index, uint64_t v) {
+    ProductIndexCursor cursor;
+    return product_index_seek(index, &cursor, v) && cursor.value == v;
+}
+
+// Number of distinct products in [lo, hi]
+static inline uint64_t product_index_range_count(const ProductIndex* index, uint64_t lo, uint64_t hi) {
+    if (hi < lo) return 0;
+    return product_index_rank(index, hi) - (lo > 0 ? product_index_rank(index, lo - 1) : 0);
+}
+#endif
+
+#endif
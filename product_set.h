@@ -0,0 +1,987 @@
+// Key-width generic part of the hash engine: the segmented hash set, radix
+// sort, the gather/alltoall/tree dedup of sorted unique products, the merge
+// engine and the streaming dedup.
+//
+// multiplication_opt_64bit.c includes this file once per key width, after
+// defining
+//   KEY_T         unsigned or signed integer type able to hold N*N
+//   KEY_MAX       largest value of KEY_T
+//   KEY_MPI       MPI datatype matching KEY_T
+//   KEY_FN(name)  the name of a function or type for this key width
+// The 64-bit instantiation keeps the plain names (hashset_add, radix_sort,
+// ...) used by the rest of the program; the 32-bit one appends 32.
+
+// The hash set is split into HASH_SEGMENTS independent linear-probing tables
+// picked by the low hash bits. Each segment grows on its own when it crosses
+// LOAD_FACTOR_THRESHOLD, so the table grows one small segment at a time: a
+// resize moves 1/HASH_SEGMENTS of the values, and the only extra memory held
+// during it is one doubled segment instead of a second copy of the table.
+typedef struct {
+    KEY_T* buckets;    // 0 marks an empty bucket
+    int64_t size;
+    int64_t count;
+    int64_t limit;     // count above which the segment doubles
+} KEY_FN(HashSegment);
+
+typedef struct {
+    KEY_FN(HashSegment) segments[HASH_SEGMENTS];
+    int64_t size;
+    int64_t count;
+} KEY_FN(HashSet);
+
+// Initialize a segment with the given number of buckets
+void KEY_FN(hash_segment_init)(KEY_FN(HashSegment)* segment, int64_t size) {
+    segment->size = size;
+    segment->count = 0;
+    segment->limit = (int64_t)(size * LOAD_FACTOR_THRESHOLD);
+    segment->buckets = (KEY_T*)calloc(size, sizeof(KEY_T));
+#ifdef HASH_STATS
+    hash_stats_bytes(size * (int64_t)sizeof(KEY_T));
+#endif
+}
+
+// Initialize a hash set with about size buckets in total
+void KEY_FN(hashset_init)(KEY_FN(HashSet)* set, int64_t size) {
+    int64_t segment_size = size / HASH_SEGMENTS;
+    if (segment_size < 16) segment_size = 16;
+
+    for (int s = 0; s < HASH_SEGMENTS; s++) {
+        KEY_FN(hash_segment_init)(&set->segments[s], segment_size);
+    }
+    set->size = segment_size * HASH_SEGMENTS;
+    set->count = 0;
+}
+
+// Place a value known to be absent in a segment with free room
+void KEY_FN(hash_segment_place)(KEY_FN(HashSegment)* segment, KEY_T value, uint64_t h) {
+    uint64_t pos = h % segment->size;
+    while (segment->buckets[pos] != 0) {
+        pos = (pos + 1) % segment->size;
+    }
+    segment->buckets[pos] = value;
+    segment->count++;
+}
+
+// Double one segment, rehashing only the values it holds
+void KEY_FN(hash_segment_grow)(KEY_FN(HashSegment)* segment) {
+#ifdef HASH_STATS
+    double grow_start = MPI_Wtime();
+#endif
+    KEY_FN(HashSegment) grown;
+    KEY_FN(hash_segment_init)(&grown, segment->size * 2);
+
+    for (int64_t i = 0; i < segment->size; i++) {
+        KEY_T value = segment->buckets[i];
+        if (value != 0) {
+            KEY_FN(hash_segment_place)(&grown, value, hash_mix((int64_t)value) / HASH_SEGMENTS);
+        }
+    }
+
+    free(segment->buckets);
+#ifdef HASH_STATS
+    hash_stats_bytes(-segment->size * (int64_t)sizeof(KEY_T));
+    hash_stats.resizes++;
+    hash_stats.resize_seconds += MPI_Wtime() - grow_start;
+#endif
+    *segment = grown;
+}
+
+// Add a value to the hash set, returns true if added (was not present)
+bool KEY_FN(hashset_add)(KEY_FN(HashSet)* set, KEY_T value) {
+    // Skip if value is 0 (our marker for empty)
+    if (value == 0) return false;
+
+    uint64_t h = hash_mix((int64_t)value);
+    KEY_FN(HashSegment)* segment = &set->segments[h % HASH_SEGMENTS];
+    h /= HASH_SEGMENTS;
+
+    // Grow just this segment if it is over the load factor
+    if (segment->count >= segment->limit) {
+        set->size -= segment->size;
+        KEY_FN(hash_segment_grow)(segment);
+        set->size += segment->size;
+    }
+
+    // Find position using linear probing
+    uint64_t pos = h % segment->size;
+#ifdef HASH_STATS
+    int64_t probe = 0;
+#endif
+    while (segment->buckets[pos] != 0) {
+        // If already exists, return false
+        if (segment->buckets[pos] == value) {
+#ifdef HASH_STATS
+            hash_stats_probe(probe);
+#endif
+            return false;
+        }
+        // Linear probing
+        pos = (pos + 1) % segment->size;
+#ifdef HASH_STATS
+        probe++;
+#endif
+    }
+#ifdef HASH_STATS
+    hash_stats_probe(probe);
+#endif
+
+    // Insert value
+    segment->buckets[pos] = value;
+    segment->count++;
+    set->count++;
+    return true;
+}
+
+// Buckets the segment that value hashes to would double from if adding value
+// made it grow, or 0 if it has room. A set kept within a memory budget checks
+// this before each add.
+static inline int64_t KEY_FN(hashset_growth)(const KEY_FN(HashSet)* set, KEY_T value) {
+    const KEY_FN(HashSegment)* segment = &set->segments[hash_mix((int64_t)value) % HASH_SEGMENTS];
+    return segment->count >= segment->limit ? segment->size : 0;
+}
+
+// Free the hash set
+void KEY_FN(hashset_free)(KEY_FN(HashSet)* set) {
+#ifdef HASH_STATS
+    if (set->size > 0) {
+        hash_stats.final_count = set->count;
+        hash_stats.final_size = set->size;
+    }
+    hash_stats_bytes(-set->size * (int64_t)sizeof(KEY_T));
+#endif
+    for (int s = 0; s < HASH_SEGMENTS; s++) {
+        free(set->segments[s].buckets);
+        set->segments[s].buckets = NULL;
+        set->segments[s].size = 0;
+        set->segments[s].count = 0;
+    }
+    set->size = 0;
+    set->count = 0;
+}
+
+// Make set an empty hash set of about size buckets. A set kept from the
+// previous --batch query (size > 0) is cleared in place while each of its
+// segments is at least the needed size and at most HASH_REUSE_SLACK times
+// it, so a batch going from the largest N down keeps one allocation for a
+// run of similar N; otherwise it is freed and allocated afresh.
+void KEY_FN(hashset_reset)(KEY_FN(HashSet)* set, int64_t size) {
+    int64_t segment_size = size / HASH_SEGMENTS;
+    if (segment_size < 16) segment_size = 16;
+
+    if (set->size > 0) {
+        bool fits = true;
+        for (int s = 0; s < HASH_SEGMENTS; s++) {
+            int64_t have = set->segments[s].size;
+            if (have < segment_size || have > segment_size * HASH_REUSE_SLACK) fits = false;
+        }
+        if (fits) {
+            for (int s = 0; s < HASH_SEGMENTS; s++) {
+                memset(set->segments[s].buckets, 0, set->segments[s].size * sizeof(KEY_T));
+                set->segments[s].count = 0;
+            }
+            set->count = 0;
+            return;
+        }
+        KEY_FN(hashset_free)(set);
+    }
+    KEY_FN(hashset_init)(set, size);
+}
+
+// Convert hash set to array for MPI transfer
+KEY_T* KEY_FN(hashset_to_array)(KEY_FN(HashSet)* set, int64_t* size) {
+    KEY_T* array = (KEY_T*)malloc((set->count > 0 ? set->count : 1) * sizeof(KEY_T));
+    int64_t idx = 0;
+
+    for (int s = 0; s < HASH_SEGMENTS; s++) {
+        const KEY_FN(HashSegment)* segment = &set->segments[s];
+        for (int64_t i = 0; i < segment->size; i++) {
+            if (segment->buckets[i] != 0) {
+                array[idx++] = segment->buckets[i];
+            }
+        }
+    }
+
+    *size = idx;
+    return array;
+}
+
+// LSD radix sort on 8-bit digits. Keys are positive products, so they sort as
+// unsigned. Only the digits below the largest key are processed and passes
+// where every key shares the same digit are skipped. scratch must hold n
+// elements; it is the only extra memory the sort uses.
+void KEY_FN(radix_sort)(KEY_T* arr, int64_t n, KEY_T* scratch) {
+    if (n < 2) return;
+
+    uint64_t max_key = 0;
+    for (int64_t k = 0; k < n; k++) {
+        if ((uint64_t)arr[k] > max_key) max_key = (uint64_t)arr[k];
+    }
+
+    KEY_T* src = arr;
+    KEY_T* dst = scratch;
+    for (int shift = 0; shift < (int)(sizeof(KEY_T) * 8) && (max_key >> shift) != 0;
+         shift += RADIX_BITS) {
+        int64_t counts[RADIX_BUCKETS] = {0};
+        for (int64_t k = 0; k < n; k++) {
+            counts[((uint64_t)src[k] >> shift) & (RADIX_BUCKETS - 1)]++;
+        }
+
+        // Every key has the same digit, the pass would only copy
+        if (counts[((uint64_t)src[0] >> shift) & (RADIX_BUCKETS - 1)] == n) continue;
+
+        int64_t offset = 0;
+        for (int d = 0; d < RADIX_BUCKETS; d++) {
+            int64_t c = counts[d];
+            counts[d] = offset;
+            offset += c;
+        }
+        for (int64_t k = 0; k < n; k++) {
+            dst[counts[((uint64_t)src[k] >> shift) & (RADIX_BUCKETS - 1)]++] = src[k];
+        }
+
+        KEY_T* tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if (src != arr) {
+        memcpy(arr, src, n * sizeof(KEY_T));
+    }
+}
+
+// Multi-threaded radix sort used for process 0's global sort. Each thread
+// histograms its own block of keys, the per-thread histograms are turned into
+// scatter offsets (digit-major, thread-minor, which keeps the sort stable) and
+// every thread scatters its block. Falls back to radix_sort without OpenMP or
+// for inputs too small to be worth the threads.
+void KEY_FN(radix_sort_parallel)(KEY_T* arr, int64_t n, KEY_T* scratch) {
+#ifdef _OPENMP
+    int max_threads = omp_get_max_threads();
+    if (max_threads < 2 || n < RADIX_PARALLEL_MIN) {
+        KEY_FN(radix_sort)(arr, n, scratch);
+        return;
+    }
+
+    uint64_t max_key = 0;
+    #pragma omp parallel for reduction(max:max_key)
+    for (int64_t k = 0; k < n; k++) {
+        if ((uint64_t)arr[k] > max_key) max_key = (uint64_t)arr[k];
+    }
+
+    int64_t* counts = (int64_t*)malloc((size_t)max_threads * RADIX_BUCKETS * sizeof(int64_t));
+    KEY_T* src = arr;
+    KEY_T* dst = scratch;
+
+    for (int shift = 0; shift < (int)(sizeof(KEY_T) * 8) && (max_key >> shift) != 0;
+         shift += RADIX_BITS) {
+        #pragma omp parallel num_threads(max_threads)
+        {
+            int threads = omp_get_num_threads();
+            int t = omp_get_thread_num();
+            int64_t lo = n * t / threads;
+            int64_t hi = n * (t + 1) / threads;
+            int64_t* my_counts = counts + (int64_t)t * RADIX_BUCKETS;
+
+            memset(my_counts, 0, RADIX_BUCKETS * sizeof(int64_t));
+            for (int64_t k = lo; k < hi; k++) {
+                my_counts[((uint64_t)src[k] >> shift) & (RADIX_BUCKETS - 1)]++;
+            }
+
+            #pragma omp barrier
+            #pragma omp single
+            {
+                int64_t offset = 0;
+                for (int d = 0; d < RADIX_BUCKETS; d++) {
+                    for (int u = 0; u < threads; u++) {
+                        int64_t c = counts[(int64_t)u * RADIX_BUCKETS + d];
+                        counts[(int64_t)u * RADIX_BUCKETS + d] = offset;
+                        offset += c;
+                    }
+                }
+            }
+
+            for (int64_t k = lo; k < hi; k++) {
+                dst[my_counts[((uint64_t)src[k] >> shift) & (RADIX_BUCKETS - 1)]++] = src[k];
+            }
+        }
+
+        KEY_T* tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if (src != arr) {
+        memcpy(arr, src, n * sizeof(KEY_T));
+    }
+    free(counts);
+#else
+    KEY_FN(radix_sort)(arr, n, scratch);
+#endif
+}
+
+// Count distinct values in a sorted array
+int64_t KEY_FN(count_sorted_unique)(const KEY_T* arr, int64_t size) {
+    if (size <= 0) return 0;
+
+    int64_t unique_count = 1;  // First element is always unique
+    for (int64_t i = 1; i < size; i++) {
+        if (arr[i] != arr[i-1]) {
+            unique_count++;
+        }
+    }
+    return unique_count;
+}
+
+// Encode a sorted array of distinct values in the wire format
+void KEY_FN(encode_run)(const KEY_T* values, int64_t count, EncodedRun* run) {
+    // Size first, so the buffer is exactly as large as the encoding
+    int64_t size = 0;
+    uint64_t previous = 0;
+    for (int64_t k = 0; k < count; k++) {
+        size += varint_size((uint64_t)values[k] - previous);
+        previous = (uint64_t)values[k];
+    }
+
+    run->bytes = (uint8_t*)malloc(size > 0 ? size : 1);
+    run->size = size;
+    run->count = count;
+
+    uint8_t* out = run->bytes;
+    previous = 0;
+    for (int64_t k = 0; k < count; k++) {
+        out += write_varint(out, (uint64_t)values[k] - previous);
+        previous = (uint64_t)values[k];
+    }
+}
+
+// Decode an encoded run into out, which must hold run->count values
+void KEY_FN(decode_run)(const EncodedRun* run, KEY_T* out) {
+    RunReader reader;
+    int64_t k = 0;
+    if (run_reader_open_bytes(&reader, run)) {
+        do {
+            out[k++] = (KEY_T)reader.value;
+        } while (run_reader_next(&reader));
+    }
+}
+
+// Gather all sorted local sets on process 0 in the compressed wire format and
+// count their union with a k-way merge over the encoded bytes, so process 0
+// never holds the products uncompressed or sorts them again. The union is
+// appended to index as it is merged unless index is NULL.
+// Returns M(N) on process 0 and 0 elsewhere.
+int64_t KEY_FN(gather_unique_count)(KEY_T* local_unique_products, int64_t local_unique_count,
+                                    ProductIndexWriter* index, int world_rank, int world_size) {
+    EncodedRun local;
+    KEY_FN(encode_run)(local_unique_products, local_unique_count, &local);
+
+    int64_t global_unique_count = 0;
+    if (world_rank == 0) {
+        EncodedRun* runs = (EncodedRun*)malloc(world_size * sizeof(EncodedRun));
+        runs[0] = local;
+        for (int r = 1; r < world_size; r++) {
+            recv_encoded_run(&runs[r], r);
+        }
+        phase_lap(PHASE_EXCHANGE);
+
+        global_unique_count = merge_encoded_runs(runs, world_size, index);
+        phase_lap(PHASE_GLOBAL_COUNT);
+
+        for (int r = 0; r < world_size; r++) {
+            free(runs[r].bytes);
+        }
+        free(runs);
+    } else {
+        // Non-root processes just send their data
+        send_encoded_run(&local, 0);
+        free(local.bytes);
+        phase_lap(PHASE_EXCHANGE);
+    }
+
+    return global_unique_count;
+}
+
+// Value-range partitioned dedup. Every process owns a disjoint slice of the
+// product values; slice boundaries come from regular samples of the sorted
+// local sets so that each slice receives a similar number of products.
+// Products are routed to their owner with MPI_Alltoallv, every owner counts
+// the distinct values of its slice, and the counts are summed on process 0.
+// Returns M(N) on process 0 and 0 elsewhere.
+int64_t KEY_FN(alltoall_unique_count)(KEY_T* local_unique_products, int64_t local_unique_count,
+                                      int world_size) {
+    // Take world_size regular samples of the sorted local set
+    KEY_T* samples = (KEY_T*)malloc(world_size * sizeof(KEY_T));
+    for (int s = 0; s < world_size; s++) {
+        samples[s] = local_unique_count > 0
+            ? local_unique_products[(local_unique_count * s) / world_size]
+            : KEY_MAX;
+    }
+
+    int64_t sample_count = (int64_t)world_size * world_size;
+    KEY_T* all_samples = (KEY_T*)malloc(sample_count * sizeof(KEY_T));
+    MPI_Allgather(samples, world_size, KEY_MPI,
+                  all_samples, world_size, KEY_MPI, MPI_COMM_WORLD);
+    KEY_T* sample_scratch = (KEY_T*)malloc(sample_count * sizeof(KEY_T));
+    KEY_FN(radix_sort)(all_samples, sample_count, sample_scratch);
+    free(sample_scratch);
+
+    // Process r owns the values v with splitters[r-1] < v <= splitters[r];
+    // the last process owns everything above the final splitter
+    KEY_T* splitters = (KEY_T*)malloc(world_size * sizeof(KEY_T));
+    for (int r = 0; r < world_size - 1; r++) {
+        splitters[r] = all_samples[(int64_t)(r + 1) * world_size];
+    }
+    splitters[world_size - 1] = KEY_MAX;
+
+    // The local set is sorted, so each owner's products form one contiguous run
+    int* send_counts = (int*)malloc(world_size * sizeof(int));
+    int* send_displs = (int*)malloc(world_size * sizeof(int));
+    int64_t pos = 0;
+    for (int r = 0; r < world_size; r++) {
+        int64_t run_start = pos;
+        while (pos < local_unique_count && local_unique_products[pos] <= splitters[r]) {
+            pos++;
+        }
+        check_mpi_count(pos - run_start, "Alltoall send");
+        check_mpi_count(run_start, "Alltoall send displacement");
+        send_counts[r] = (int)(pos - run_start);
+        send_displs[r] = (int)run_start;
+    }
+
+    int* recv_counts = (int*)malloc(world_size * sizeof(int));
+    int* recv_displs = (int*)malloc(world_size * sizeof(int));
+    MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, MPI_COMM_WORLD);
+
+    int64_t recv_total = 0;
+    for (int r = 0; r < world_size; r++) {
+        check_mpi_count(recv_total, "Alltoall receive displacement");
+        recv_displs[r] = (int)recv_total;
+        recv_total += recv_counts[r];
+    }
+    check_mpi_count(recv_total, "Alltoall receive");
+
+    KEY_T* slice = (KEY_T*)malloc((recv_total > 0 ? recv_total : 1) * sizeof(KEY_T));
+    MPI_Alltoallv(local_unique_products, send_counts, send_displs, KEY_MPI,
+                  slice, recv_counts, recv_displs, KEY_MPI, MPI_COMM_WORLD);
+    phase_lap(PHASE_EXCHANGE);
+
+    // Dedup this process's slice of the value range
+    KEY_T* scratch = (KEY_T*)malloc((recv_total > 0 ? recv_total : 1) * sizeof(KEY_T));
+    KEY_FN(radix_sort)(slice, recv_total, scratch);
+    free(scratch);
+    int64_t slice_unique_count = KEY_FN(count_sorted_unique)(slice, recv_total);
+
+    int64_t global_unique_count = 0;
+    MPI_Reduce(&slice_unique_count, &global_unique_count, 1, MPI_LONG_LONG,
+               MPI_SUM, 0, MPI_COMM_WORLD);
+    phase_lap(PHASE_GLOBAL_COUNT);
+
+    free(slice);
+    free(recv_displs);
+    free(recv_counts);
+    free(send_displs);
+    free(send_counts);
+    free(splitters);
+    free(all_samples);
+    free(samples);
+
+    return global_unique_count;
+}
+
+// Merge two sorted runs of distinct values into out, which must have room for
+// size1 + size2 values; values in both runs are kept once. Returns the length
+// of the merged run.
+int64_t KEY_FN(merge_unique)(const KEY_T* arr1, int64_t size1, const KEY_T* arr2, int64_t size2,
+                             KEY_T* out) {
+    int64_t i = 0, j = 0, k = 0;
+
+    while (i < size1 && j < size2) {
+        if (arr1[i] < arr2[j]) {
+            out[k++] = arr1[i++];
+        } else if (arr1[i] > arr2[j]) {
+            out[k++] = arr2[j++];
+        } else { // Equal elements
+            out[k++] = arr1[i++];
+            j++;
+        }
+    }
+
+    // Handle remaining elements
+    while (i < size1) out[k++] = arr1[i++];
+    while (j < size2) out[k++] = arr2[j++];
+
+    return k;
+}
+
+// Binomial-tree dedup. In the round with step s, every process still holding
+// a run whose rank has bit s set sends it to rank - s and drops out; the
+// receiver merges it into its own run in linear time. Runs only shrink as
+// duplicates meet, and the merges of a round run on P / 2s processes at once,
+// so after log2(P) rounds process 0 holds the deduplicated union. Runs travel
+// in the compressed wire format. Process 0 appends the union to index unless
+// it is NULL.
+// Returns M(N) on process 0 and 0 elsewhere.
+int64_t KEY_FN(tree_unique_count)(KEY_T* local_unique_products, int64_t local_unique_count,
+                                  ProductIndexWriter* index, int world_rank, int world_size) {
+    KEY_T* run = local_unique_products;
+    int64_t run_count = local_unique_count;
+
+    for (int step = 1; step < world_size; step <<= 1) {
+        if (world_rank & step) {
+            EncodedRun encoded;
+            KEY_FN(encode_run)(run, run_count, &encoded);
+            send_encoded_run(&encoded, world_rank - step);
+            free(encoded.bytes);
+            phase_lap(PHASE_EXCHANGE);
+            break;
+        }
+        if (world_rank + step >= world_size) continue;
+
+        EncodedRun encoded;
+        recv_encoded_run(&encoded, world_rank + step);
+        int64_t incoming_count = encoded.count;
+        KEY_T* incoming = (KEY_T*)malloc((incoming_count > 0 ? incoming_count : 1) * sizeof(KEY_T));
+        KEY_FN(decode_run)(&encoded, incoming);
+        free(encoded.bytes);
+        phase_lap(PHASE_EXCHANGE);
+
+        int64_t merged_room = run_count + incoming_count;
+        KEY_T* merged = (KEY_T*)malloc((merged_room > 0 ? merged_room : 1) * sizeof(KEY_T));
+        int64_t merged_count = KEY_FN(merge_unique)(run, run_count, incoming, incoming_count, merged);
+        free(incoming);
+        if (run != local_unique_products) free(run);
+        run = merged;
+        run_count = merged_count;
+        phase_lap(PHASE_GLOBAL_COUNT);
+    }
+
+    if (index != NULL) {
+        for (int64_t k = 0; k < run_count; k++) {
+            product_index_writer_add(index, (uint64_t)run[k]);
+        }
+    }
+
+    if (run != local_unique_products) free(run);
+    return (world_rank == 0) ? run_count : 0;
+}
+
+// Combine this process's sorted unique products with every other process's
+// using the selected dedup strategy. Takes ownership of the array.
+// Returns M(N) on process 0 and 0 elsewhere.
+int64_t KEY_FN(combine_sorted_products)(KEY_T* local_unique_products, int64_t local_unique_count,
+                                        const Options* opts, int world_rank, int world_size) {
+    ProductIndexWriter index_writer;
+    ProductIndexWriter* index = open_index_output(&index_writer, opts, world_rank);
+
+    int64_t global_unique_count;
+    if (opts->dedup == DEDUP_ALLTOALL) {
+        global_unique_count = KEY_FN(alltoall_unique_count)(local_unique_products,
+                                                            local_unique_count, world_size);
+    } else if (opts->dedup == DEDUP_TREE) {
+        global_unique_count = KEY_FN(tree_unique_count)(local_unique_products, local_unique_count,
+                                                        index, world_rank, world_size);
+    } else {
+        global_unique_count = KEY_FN(gather_unique_count)(local_unique_products, local_unique_count,
+                                                          index, world_rank, world_size);
+    }
+
+    free(local_unique_products);
+    close_index_output(index, opts);
+
+    // Add back the values 1..N that no pair was generated for
+    if (world_rank == 0) global_unique_count += opts->N;
+    return global_unique_count;
+}
+
+// Sort this process's unique products and combine them with every other
+// process's using the selected dedup strategy. Takes ownership of the array.
+// Returns M(N) on process 0 and 0 elsewhere.
+int64_t KEY_FN(combine_local_products)(KEY_T* local_unique_products, int64_t local_unique_count,
+                                       const Options* opts, int world_rank, int world_size) {
+    // Sort the local array for easier merging
+    KEY_T* scratch = (KEY_T*)malloc((local_unique_count > 0 ? local_unique_count : 1) * sizeof(KEY_T));
+    KEY_FN(radix_sort_parallel)(local_unique_products, local_unique_count, scratch);
+    free(scratch);
+    phase_lap(PHASE_LOCAL_SORT);
+
+    return KEY_FN(combine_sorted_products)(local_unique_products, local_unique_count,
+                                           opts, world_rank, world_size);
+}
+
+// PairRangeFn: add the product of every pair in the range to a HashSet
+void KEY_FN(hashset_add_range)(void* ctx, int64_t N, int64_t start_idx, int64_t end_idx) {
+    KEY_FN(HashSet)* set = (KEY_FN(HashSet)*)ctx;
+    PairSpan span = pair_span(N, start_idx, end_idx);
+
+    for (int64_t i = span.first_i; i <= span.last_i; i++) {
+        int64_t j_first = covered_row_start(N, i, (i == span.first_i) ? span.first_j : i);
+        int64_t j_last = (i == span.last_i) ? span.last_j : N;
+        for (int64_t j = j_first; j <= j_last; j++) {
+            KEY_FN(hashset_add)(set, (KEY_T)(i * j));
+        }
+    }
+}
+
+// PairRangeFn over triple indexes: insert the products i*j*k of the range.
+// The triples of one (i, j) are a row k = j..N with step i*j, started past N
+// like the pair rows, since (1, 1, k) already gives every value up to N.
+void KEY_FN(hashset_add_triples)(void* ctx, int64_t N, int64_t start_idx, int64_t end_idx) {
+    KEY_FN(HashSet)* set = (KEY_FN(HashSet)*)ctx;
+    int64_t i, j, k_first, last_i, last_j, last_k;
+    triple_at(N, start_idx, &i, &j, &k_first);
+    triple_at(N, end_idx, &last_i, &last_j, &last_k);
+
+    while (true) {
+        bool last_row = (i == last_i && j == last_j);
+        int64_t ij = i * j;
+        int64_t k_last = last_row ? last_k : N;
+        for (int64_t k = covered_row_start(N, ij, k_first); k <= k_last; k++) {
+            KEY_FN(hashset_add)(set, (KEY_T)(ij * k));
+        }
+        if (last_row) break;
+
+        if (++j > N) {
+            i++;
+            j = i;
+        }
+        k_first = j;
+    }
+}
+
+// Fill this process's hash set with its products: every assigned range by
+// default, or from and with checkpoints in the 64-bit checkpoint mode
+typedef void (*KEY_FN(HashFillFn))(KEY_FN(HashSet)* set, const Options* opts,
+                                   int world_rank, int world_size);
+
+// HashFillFn: insert the products of every range assigned to this process
+void KEY_FN(hash_fill_assigned)(KEY_FN(HashSet)* set, const Options* opts,
+                                int world_rank, int world_size) {
+    PairRangeFn add_range = (opts->factors == 3) ? KEY_FN(hashset_add_triples)
+                                                 : KEY_FN(hashset_add_range);
+    for_each_assigned_range(opts, world_rank, world_size, add_range, set);
+}
+
+// Hash set kept between the queries of a --batch run
+KEY_FN(HashSet) KEY_FN(batch_set);
+
+// Hash set engine body: fill a presized hash set, then combine the local sets
+// with the selected dedup strategy. Returns M(N) on process 0 and 0 elsewhere.
+int64_t KEY_FN(hash_set_count)(const Options* opts, int world_rank, int world_size,
+                               KEY_FN(HashFillFn) fill) {
+    // Initialize hash set for this process
+    // Size it so the expected number of unique elements stays under the load factor
+    int64_t expected_unique = estimate_local_distinct(opts, world_rank, world_size);
+    int64_t initial_hashset_size = (int64_t)(expected_unique / LOAD_FACTOR_THRESHOLD) + 1;
+    if (initial_hashset_size < 1024) initial_hashset_size = 1024;
+
+    // A batch reuses the set of its previous query
+    KEY_FN(HashSet) own_set;
+    KEY_FN(HashSet)* unique_products = &own_set;
+    if (opts->batch_count > 0) {
+        unique_products = &KEY_FN(batch_set);
+        KEY_FN(hashset_reset)(unique_products, initial_hashset_size);
+    } else {
+        KEY_FN(hashset_init)(unique_products, initial_hashset_size);
+    }
+
+    fill(unique_products, opts, world_rank, world_size);
+
+    // Signal completion of local computation
+    report_local_done(world_rank, world_size);
+
+    // Convert local unique products to array for MPI transfer
+    int64_t local_unique_count = unique_products->count;
+    KEY_T* local_unique_products = KEY_FN(hashset_to_array)(unique_products, &local_unique_count);
+
+    // The array holds every local product, so the set can go before the merge
+    // unless the next query of the batch reuses it
+    if (unique_products == &own_set) {
+        KEY_FN(hashset_free)(unique_products);
+    } else {
+#ifdef HASH_STATS
+        hash_stats.final_count = unique_products->count;
+        hash_stats.final_size = unique_products->size;
+#endif
+    }
+    phase_lap(PHASE_TO_ARRAY);
+
+    return KEY_FN(combine_local_products)(local_unique_products, local_unique_count,
+                                          opts, world_rank, world_size);
+}
+
+// Merge engine. Row i of the triangle, i*j_first, i*(j_first+1), ..., is an
+// arithmetic progression and so already sorted; a min-heap of one cursor per
+// assigned row yields all of this process's products in order, and a value
+// is kept when it differs from the last one kept. The result is the sorted
+// unique array the dedup strategies take, with no hashing, hash table or
+// local sort. Returns M(N) on process 0 and 0 elsewhere.
+int64_t KEY_FN(merge_engine_count)(const Options* opts, int world_rank, int world_size) {
+    int64_t N = opts->N;
+    int64_t start_idx, end_idx;
+    partition_range(table_items(opts), world_rank, world_size, &start_idx, &end_idx);
+    PairSpan span = pair_span(N, start_idx, end_idx);
+
+    // One cursor per row that still has products above N, in order of their
+    // first product. Row i only joins the heap once the merge reaches its
+    // first product, and leaves it after i*N, so the heap holds just the rows
+    // spanning the current value (at most about N/4 of them).
+    int64_t rows = span.last_i - span.first_i + 1;
+    RowCursor* pending = (RowCursor*)malloc((rows > 0 ? rows : 1) * sizeof(RowCursor));
+    RowCursor* heap = (RowCursor*)malloc((rows > 0 ? rows : 1) * sizeof(RowCursor));
+    int64_t pending_count = 0;
+    for (int64_t i = span.first_i; i <= span.last_i; i++) {
+        int64_t j_first = covered_row_start(N, i, (i == span.first_i) ? span.first_j : i);
+        int64_t j_last = (i == span.last_i) ? span.last_j : N;
+        if (j_first > j_last) continue;
+
+        pending[pending_count].value = i * j_first;
+        pending[pending_count].step = i;
+        pending[pending_count].last = i * j_last;
+        pending_count++;
+    }
+    qsort(pending, pending_count, sizeof(RowCursor), compare_row_start);
+
+    // The estimate bounds the output; grow by half if it falls short
+    int64_t capacity = estimate_local_distinct(opts, world_rank, world_size) + 1;
+    KEY_T* values = (KEY_T*)malloc(capacity * sizeof(KEY_T));
+    int64_t count = 0;
+    int64_t heap_size = 0;
+    int64_t next_row = 0;
+    while (heap_size > 0 || next_row < pending_count) {
+        while (next_row < pending_count
+               && (heap_size == 0 || pending[next_row].value <= heap[0].value)) {
+            row_heap_push(heap, &heap_size, pending[next_row++]);
+        }
+
+        RowCursor* top = &heap[0];
+        if (count == 0 || (KEY_T)top->value != values[count - 1]) {
+            if (count == capacity) {
+                capacity += capacity / 2 + 1;
+                values = (KEY_T*)realloc(values, capacity * sizeof(KEY_T));
+            }
+            values[count++] = (KEY_T)top->value;
+        }
+
+        if (top->value == top->last) {
+            heap[0] = heap[--heap_size];
+        } else {
+            top->value += top->step;
+        }
+        row_heap_down(heap, heap_size, 0);
+    }
+    free(heap);
+    free(pending);
+
+    // Signal completion of local computation
+    report_local_done(world_rank, world_size);
+
+    return KEY_FN(combine_sorted_products)(values, count, opts, world_rank, world_size);
+}
+
+// Streaming dedup. Every product value has an owner process, picked by its
+// hash so that owners receive similar shares. Each process generates its
+// pairs in blocks of STREAM_BLOCK_PAIRS; after a block, the block's products
+// are sorted, deduplicated, split by owner, delta + varint encoded and sent with
+// MPI_Isend while the next block is generated. Between blocks a process
+// inserts whatever chunks have arrived into the set of values it owns, so
+// sending, receiving and generating overlap. A process that is more than
+// STREAM_MAX_PENDING_BLOCKS blocks of sends ahead of its receivers keeps
+// receiving until enough sends complete, so unsent chunks never hold more
+// than that many blocks. Each owner counts its set and the counts are summed.
+typedef struct {
+    int world_rank;
+    int world_size;
+    KEY_FN(HashSet) owned;   // every product owned by this process seen so far
+    KEY_T* block;            // products of the block being flushed
+    KEY_T* scratch;          // radix sort buffer for the block
+    int* owners;             // owner of each distinct product of the block
+    int64_t* owner_bytes;    // encoded size per owner of the block
+    PendingSends pending;
+} KEY_FN(StreamState);
+
+// Owner process of a product value
+static inline int KEY_FN(stream_owner)(KEY_T value, int world_size) {
+    return (int)((hash_mix((int64_t)value) >> 16) % (uint64_t)world_size);
+}
+
+// Insert every value of a received chunk into the owned set
+void KEY_FN(stream_insert_chunk)(KEY_FN(StreamState)* state, const uint8_t* bytes, int size) {
+    const uint8_t* pos = bytes;
+    const uint8_t* end = bytes + size;
+    uint64_t value = 0;
+    while (pos < end) {
+        value += read_varint(&pos);
+        KEY_FN(hashset_add)(&state->owned, (KEY_T)value);
+    }
+}
+
+// Receive one waiting message; returns true if it was an end-of-stream marker
+bool KEY_FN(stream_receive)(KEY_FN(StreamState)* state, const MPI_Status* status) {
+    int size;
+    MPI_Get_count(status, MPI_BYTE, &size);
+    uint8_t* bytes = (uint8_t*)malloc(size > 0 ? size : 1);
+    MPI_Recv(bytes, size, MPI_BYTE, status->MPI_SOURCE, status->MPI_TAG, MPI_COMM_WORLD,
+             MPI_STATUS_IGNORE);
+    if (status->MPI_TAG == STREAM_TAG_DATA) {
+        KEY_FN(stream_insert_chunk)(state, bytes, size);
+    }
+    free(bytes);
+    return status->MPI_TAG == STREAM_TAG_DONE;
+}
+
+// Send the count distinct products of the block to their owners, then take
+// in every chunk that has already arrived
+void KEY_FN(stream_flush)(KEY_FN(StreamState)* state, int64_t count) {
+    int world_size = state->world_size;
+    KEY_T* values = state->block;
+
+    // Sort and drop the block's duplicates in place
+    KEY_FN(radix_sort)(values, count, state->scratch);
+    int64_t distinct = 0;
+    for (int64_t k = 0; k < count; k++) {
+        if (distinct == 0 || values[k] != values[distinct - 1]) values[distinct++] = values[k];
+    }
+    count = distinct;
+
+    // Size every owner's chunk, then encode them all in one pass
+    uint64_t* previous = (uint64_t*)calloc(world_size, sizeof(uint64_t));
+    memset(state->owner_bytes, 0, world_size * sizeof(int64_t));
+    for (int64_t k = 0; k < count; k++) {
+        int owner = KEY_FN(stream_owner)(values[k], world_size);
+        state->owners[k] = owner;
+        state->owner_bytes[owner] += varint_size((uint64_t)values[k] - previous[owner]);
+        previous[owner] = (uint64_t)values[k];
+    }
+
+    uint8_t** chunks = (uint8_t**)calloc(world_size, sizeof(uint8_t*));
+    uint8_t** out = (uint8_t**)calloc(world_size, sizeof(uint8_t*));
+    for (int r = 0; r < world_size; r++) {
+        if (r != state->world_rank && state->owner_bytes[r] > 0) {
+            chunks[r] = out[r] = (uint8_t*)malloc(state->owner_bytes[r]);
+        }
+        previous[r] = 0;
+    }
+    for (int64_t k = 0; k < count; k++) {
+        int owner = state->owners[k];
+        if (owner == state->world_rank) {
+            KEY_FN(hashset_add)(&state->owned, values[k]);
+        } else {
+            out[owner] += write_varint(out[owner], (uint64_t)values[k] - previous[owner]);
+            previous[owner] = (uint64_t)values[k];
+        }
+    }
+    for (int r = 0; r < world_size; r++) {
+        if (chunks[r] != NULL) {
+            pending_sends_post(&state->pending, chunks[r], state->owner_bytes[r], r, STREAM_TAG_DATA);
+        }
+    }
+
+    free(out);
+    free(chunks);
+    free(previous);
+
+    // Take in what has arrived and release finished send buffers. While too
+    // many sends are in flight, keep doing so instead of generating more;
+    // receiving meanwhile lets peers doing the same make progress
+    int max_pending = STREAM_MAX_PENDING_BLOCKS * (world_size - 1);
+    do {
+        int waiting;
+        MPI_Status status;
+        MPI_Iprobe(MPI_ANY_SOURCE, STREAM_TAG_DATA, MPI_COMM_WORLD, &waiting, &status);
+        while (waiting) {
+            KEY_FN(stream_receive)(state, &status);
+            MPI_Iprobe(MPI_ANY_SOURCE, STREAM_TAG_DATA, MPI_COMM_WORLD, &waiting, &status);
+        }
+        pending_sends_reap(&state->pending, false);
+    } while (state->pending.count > max_pending);
+}
+
+// PairRangeFn: generate the range a block of STREAM_BLOCK_PAIRS products at a
+// time, flushing each block
+void KEY_FN(stream_add_range)(void* ctx, int64_t N, int64_t start_idx, int64_t end_idx) {
+    KEY_FN(StreamState)* state = (KEY_FN(StreamState)*)ctx;
+    for (int64_t block_start = start_idx; block_start <= end_idx; block_start += STREAM_BLOCK_PAIRS) {
+        int64_t block_end = block_start + STREAM_BLOCK_PAIRS - 1;
+        if (block_end > end_idx) block_end = end_idx;
+
+        PairSpan span = pair_span(N, block_start, block_end);
+        int64_t count = 0;
+        for (int64_t i = span.first_i; i <= span.last_i; i++) {
+            int64_t j_first = covered_row_start(N, i, (i == span.first_i) ? span.first_j : i);
+            int64_t j_last = (i == span.last_i) ? span.last_j : N;
+            for (int64_t j = j_first; j <= j_last; j++) {
+                state->block[count++] = (KEY_T)(i * j);
+            }
+        }
+        KEY_FN(stream_flush)(state, count);
+    }
+}
+
+// Hash engine with streaming dedup. Returns M(N) on process 0 and 0 elsewhere.
+int64_t KEY_FN(stream_hash_count)(const Options* opts, int world_rank, int world_size) {
+    KEY_FN(StreamState) state;
+    state.world_rank = world_rank;
+    state.world_size = world_size;
+    state.owner_bytes = (int64_t*)malloc(world_size * sizeof(int64_t));
+    state.pending.requests = NULL;
+    state.pending.buffers = NULL;
+    state.pending.count = 0;
+    state.pending.capacity = 0;
+
+    // This process owns about 1/P of M(N), which its own share bounds from above
+    int64_t expected_unique = estimate_local_distinct(opts, world_rank, world_size);
+    KEY_FN(hashset_init)(&state.owned, (int64_t)(expected_unique / LOAD_FACTOR_THRESHOLD) + 1024);
+    state.block = (KEY_T*)malloc(STREAM_BLOCK_PAIRS * sizeof(KEY_T));
+    state.scratch = (KEY_T*)malloc(STREAM_BLOCK_PAIRS * sizeof(KEY_T));
+    state.owners = (int*)malloc(STREAM_BLOCK_PAIRS * sizeof(int));
+
+    for_each_assigned_range(opts, world_rank, world_size, KEY_FN(stream_add_range), &state);
+    free(state.owners);
+    free(state.scratch);
+    free(state.block);
+
+    // Tell every other process this one has nothing more to send; messages
+    // between two processes arrive in order, so the marker comes last
+    for (int r = 0; r < world_size; r++) {
+        if (r != world_rank) {
+            pending_sends_post(&state.pending, (uint8_t*)malloc(1), 0, r, STREAM_TAG_DONE);
+        }
+    }
+
+    // Signal completion of local computation
+    report_local_done(world_rank, world_size);
+
+    // Drain the remaining chunks until every other process has finished
+    int done = 0;
+    while (done < world_size - 1) {
+        MPI_Status status;
+        MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);  // DATA or DONE
+        if (KEY_FN(stream_receive)(&state, &status)) done++;
+    }
+    pending_sends_reap(&state.pending, true);
+
+    // A process that has drained every marker may start the next --batch
+    // query and send its chunks, which the wildcard probes above would take
+    // for this one; wait until every process has drained this query
+    MPI_Barrier(MPI_COMM_WORLD);
+    free(state.pending.requests);
+    free(state.pending.buffers);
+    free(state.owner_bytes);
+    phase_lap(PHASE_EXCHANGE);
+
+    int64_t owned_count = state.owned.count;
+    KEY_FN(hashset_free)(&state.owned);
+
+    int64_t global_unique_count = 0;
+    MPI_Reduce(&owned_count, &global_unique_count, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    phase_lap(PHASE_GLOBAL_COUNT);
+
+    // Add back the values 1..N that no pair was generated for
+    if (world_rank == 0) global_unique_count += opts->N;
+    return global_unique_count;
+}
+
+#undef KEY_T
+#undef KEY_MAX
+#undef KEY_MPI
+#undef KEY_FN
@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+"""Benchmark multiplication_opt_64bit over a grid of N values and process counts.
+
+Every run is started with --timings so each process records how long it spent
+in each phase (generate, wait, to_array, local_sort, exchange, global_count).
+Three files are written:
+
+  <out>_runs.csv      one row per process per run, as recorded by the program
+  <out>_summary.csv   min/median/max of every phase for each (N, processes)
+  <out>_summary.json  the same summary as JSON
+
+A phase's time for one run is the slowest process's time, since that is what
+holds up the run. Min, median and max are then taken over the repeats.
+
+Arguments after -- go to every run, including the table shape: --rows=M for
+the M x N table (result line "M(MxN) = ...") or --factors=3 for i*j*k
+("M3(N) = ..."). The n column is always the N given on the command line.
+"""
+
+import argparse
+import csv
+import json
+import os
+import re
+import shlex
+import statistics
+import subprocess
+import sys
+import tempfile
+
+# Result line of any table shape: "M(N) = count", "M(MxN) = count",
+# "M3(N) = count", or "... ~ estimate (+/- ...)" in --approx mode
+RESULT_LINE = re.compile(r"^M\d*\([^)]*\) [=~] (\d+)")
+
+PHASES = ["generate", "wait", "to_array", "local_sort", "exchange", "global_count", "total"]
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--binary", default="./multiplication_opt_64bit")
+    parser.add_argument("--mpirun", default="mpirun",
+                        help="launcher command, e.g. 'mpirun --oversubscribe'")
+    parser.add_argument("--n", type=int, nargs="+", required=True, help="table sizes to run")
+    parser.add_argument("--procs", type=int, nargs="+", required=True, help="process counts to run")
+    parser.add_argument("--repeats", type=int, default=3)
+    parser.add_argument("--out", default="Results/benchmark", help="output path prefix")
+    parser.add_argument("extra", nargs="*", help="arguments passed to every run (after --)")
+    return parser.parse_args()
+
+
+def run_once(args, n, procs, timings_path):
+    command = shlex.split(args.mpirun) + ["-n", str(procs), args.binary, str(n),
+                                          "--timings=" + timings_path] + args.extra
+    result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                            universal_newlines=True)
+    if result.returncode != 0:
+        sys.exit("Run failed: %s\n%s" % (" ".join(command), result.stdout))
+
+    unique = None
+    for line in result.stdout.splitlines():
+        match = RESULT_LINE.match(line)
+        if match:
+            unique = match.group(1)
+    if unique is None:
+        sys.exit("No result line in the output of: %s\n%s" % (" ".join(command), result.stdout))
+    return unique
+
+
+def summarize(rows):
+    """Group per-process rows by configuration and run, then reduce."""
+    runs = {}
+    for row in rows:
+        config = (int(row["n"]), int(row["processes"]), row["engine"], row["dedup"], row["schedule"])
+        runs.setdefault(config, {}).setdefault(row["run"], []).append(row)
+
+    summary = []
+    for config in sorted(runs):
+        n, procs, engine, dedup, schedule = config
+        entry = {"n": n, "processes": procs, "engine": engine, "dedup": dedup,
+                 "schedule": schedule, "repeats": len(runs[config]), "phases": {}}
+        for phase in PHASES:
+            slowest = [max(float(r[phase]) for r in ranks) for ranks in runs[config].values()]
+            entry["phases"][phase] = {"min": round(min(slowest), 6),
+                                      "median": round(statistics.median(slowest), 6),
+                                      "max": round(max(slowest), 6)}
+        summary.append(entry)
+    return summary
+
+
+def main():
+    args = parse_args()
+    out_dir = os.path.dirname(args.out)
+    if out_dir:
+        os.makedirs(out_dir, exist_ok=True)
+
+    rows = []
+    for n in args.n:
+        for procs in args.procs:
+            for repeat in range(args.repeats):
+                handle, timings_path = tempfile.mkstemp(suffix=".csv")
+                os.close(handle)
+                os.remove(timings_path)
+                try:
+                    unique = run_once(args, n, procs, timings_path)
+                    with open(timings_path, newline="") as f:
+                        for row in csv.DictReader(f):
+                            row["run"] = str(repeat)
+                            row["unique"] = unique
+                            rows.append(row)
+                finally:
+                    if os.path.exists(timings_path):
+                        os.remove(timings_path)
+                print("N=%d processes=%d run %d/%d: M=%s" % (n, procs, repeat + 1, args.repeats, unique))
+                sys.stdout.flush()
+
+    fields = ["n", "processes", "engine", "dedup", "schedule", "run", "rank", "unique"] + PHASES
+    with open(args.out + "_runs.csv", "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=fields)
+        writer.writeheader()
+        for row in rows:
+            writer.writerow({k: row[k] for k in fields})
+
+    summary = summarize(rows)
+    with open(args.out + "_summary.csv", "w", newline="") as f:
+        writer = csv.writer(f)
+        writer.writerow(["n", "processes", "engine", "dedup", "schedule", "repeats", "phase",
+                         "min", "median", "max"])
+        for entry in summary:
+            for phase in PHASES:
+                stats = entry["phases"][phase]
+                writer.writerow([entry["n"], entry["processes"], entry["engine"], entry["dedup"],
+                                 entry["schedule"], entry["repeats"], phase,
+                                 "%.6f" % stats["min"], "%.6f" % stats["median"],
+                                 "%.6f" % stats["max"]])
+
+    with open(args.out + "_summary.json", "w") as f:
+        json.dump(summary, f, indent=2)
+
+    print("Wrote %s_runs.csv, %s_summary.csv and %s_summary.json" % (args.out, args.out, args.out))
+
+
+if __name__ == "__main__":
+    main()